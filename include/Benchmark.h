@@ -0,0 +1,103 @@
+/**
+ * @file Benchmark.h
+ *
+ * @author ctrlaltf2
+ *
+ *  @section DESCRIPTION
+ *  Options for the headless benchmark mode.
+ */
+
+struct BenchmarkOptions;
+struct ProtocolBenchmarkOptions;
+
+#pragma once
+#include <cstdint>
+#include <string>
+
+/**
+ * @struct BenchmarkOptions
+ *
+ * POD struct describing a benchmark run. The core is run unthrottled without the websocket server, and each
+ * stage of the frame pipeline after emulation can be turned on separately.
+ */
+struct BenchmarkOptions {
+    /**
+     * Path to the libretro core to benchmark
+     */
+    std::string corePath;
+
+    /**
+     * Path to the rom to load, can be empty for cores that don't need one
+     */
+    std::string romPath;
+
+    /**
+     * Input movie to replay, if any. The benchmark stops early when the movie ends.
+     */
+    std::string replayPath;
+
+    /**
+     * How many frames to run
+     */
+    std::uint64_t frames{3600};
+
+    /**
+     * Whether or not to convert every frame to XRGB8888
+     */
+    bool convert{false};
+
+    /**
+     * Whether or not to jpeg encode every frame. Implies convert.
+     */
+    bool encode{false};
+
+    /**
+     * How many mock connections every encoded frame is sent to
+     */
+    std::uint64_t sinks{0};
+
+    /**
+     * Whether or not to capture rewind states, with the interval and memory from the emulator template
+     */
+    bool rewind{false};
+
+    /**
+     * Whether or not to record an input movie
+     */
+    bool recordInput{false};
+
+    /**
+     * Frames to run ahead, 0 to turn run-ahead off
+     */
+    std::uint64_t runAheadFrames{0};
+
+    /**
+     * Whether or not run-ahead uses a second instance of the core
+     */
+    bool runAheadSecondInstance{false};
+};
+
+/**
+ * @struct ProtocolBenchmarkOptions
+ *
+ * POD struct describing a protocol benchmark run, which decodes recorded client messages without the server.
+ */
+struct ProtocolBenchmarkOptions {
+    /**
+     * Messages to decode. Either a server log, whose "raw: '...'" lines are the messages clients sent, or one message
+     * per line.
+     */
+    std::string capturePath;
+
+    /**
+     * How many times to decode the whole capture
+     */
+    std::uint64_t iterations{100};
+};
+
+/**
+ * Decodes a capture with every LetsPlayProtocol decoder and prints the time per message for each
+ *
+ * @return The exit code for the process
+ */
+int BenchmarkProtocol(const ProtocolBenchmarkOptions &options);
@@ -0,0 +1,50 @@
+/**
+ * @file BufferPool.h
+ *
+ * @author ctrlaltf2
+ *
+ */
+class BufferPool;
+
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+/**
+ * A byte buffer handed out by a BufferPool. Goes back to the pool when the last copy is destroyed, on whatever
+ * thread that happens.
+ */
+using PooledBuffer = std::shared_ptr<std::vector<std::uint8_t>>;
+
+/**
+ * @class BufferPool
+ *
+ * Recycles large byte buffers (save states) so that they aren't reallocated every time they're needed.
+ */
+class BufferPool {
+    /**
+     * Free buffers, shared with the buffers' deleters so that buffers can outlive the pool
+     */
+    struct Storage {
+        std::mutex mutex;
+        std::vector<std::unique_ptr<std::vector<std::uint8_t>>> buffers;
+        size_t maxBuffers;
+    };
+
+    std::shared_ptr<Storage> m_storage;
+
+  public:
+    /**
+     * @param maxBuffers How many free buffers to keep around at most
+     */
+    explicit BufferPool(size_t maxBuffers = 4);
+
+    /**
+     * Gets a buffer of a certain size. The contents are unspecified.
+     *
+     * @param size Size of the buffer in bytes
+     */
+    PooledBuffer Acquire(size_t size);
+};
@@ -0,0 +1,149 @@
+/**
+ * @file ChunkStore.h
+ *
+ * @author ctrlaltf2
+ *
+ *  @section DESCRIPTION
+ *  Content addressed storage for states, so that identical data across history and backups is only stored once.
+ */
+
+class ChunkStore;
+
+#pragma once
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+
+#include "md5.h"
+#include "StateCodec.h"
+
+/*
+ * Data put in the store is split into chunks at content defined boundaries (gear hash), so an insertion or
+ * removal only changes the chunks around it. Each chunk is named by the md5 of its contents and stored once at
+ * store/<first two hex digits>/<md5>, compressed as a StateCodec keyframe.
+ *
+ * What was stored is described by a manifest file, which lives wherever its owner wants it:
+ *
+ *  LPMF 1
+ *  size <total size>
+ *  <md5> <chunk size>
+ *  ...
+ *
+ * Chunks are reference counted by the manifests pointing at them and deleted once nothing does. The counts aren't
+ * saved, they're rebuilt from the manifests on startup.
+ */
+
+/**
+ * @class ChunkStore
+ *
+ * A chunk store for one emulator. Thread-safe.
+ */
+class ChunkStore {
+    /**
+     * A stored chunk
+     */
+    struct Chunk {
+        /**
+         * How many manifests refer to the chunk, counting repeats within a manifest
+         */
+        std::uint64_t references{0};
+
+        /**
+         * Size of the chunk file
+         */
+        std::uint64_t storedSize{0};
+    };
+
+    /**
+     * The directory chunks are stored in
+     */
+    boost::filesystem::path m_root;
+
+    /**
+     * Every referenced chunk, by id
+     */
+    std::map<std::string, Chunk> m_chunks;
+
+    /**
+     * Total size of the chunk files in m_chunks
+     */
+    std::uint64_t m_storedBytes{0};
+
+    /**
+     * Mutex for everything
+     */
+    std::mutex m_mutex;
+
+    /**
+     * Path of a chunk's file
+     */
+    boost::filesystem::path ChunkPath(const std::string &id) const;
+
+    /**
+     * Removes a reference to a chunk, deleting it if it was the last one. m_mutex must be held.
+     */
+    void Release(const std::string &id);
+
+  public:
+    /**
+     * @param root The directory to store chunks in, created if it doesn't exist
+     */
+    explicit ChunkStore(const boost::filesystem::path &root);
+
+    /**
+     * Stores data and writes a manifest describing it
+     *
+     * @param manifestPath Where to write the manifest
+     * @param data The data to store
+     * @param size Size of data
+     *
+     * @return Whether or not everything was written
+     */
+    bool Put(const boost::filesystem::path &manifestPath, const std::uint8_t *data, size_t size);
+
+    /**
+     * Reads back the data described by a manifest
+     *
+     * @param manifestPath The manifest
+     * @param out Where to put the data
+     *
+     * @return Whether or not the manifest and every chunk in it could be read
+     */
+    bool Get(const boost::filesystem::path &manifestPath, std::vector<std::uint8_t> &out);
+
+    /**
+     * Deletes a manifest and any chunks nothing else refers to
+     *
+     * @param manifestPath The manifest
+     */
+    void Remove(const boost::filesystem::path &manifestPath);
+
+    /**
+     * Recounts the references from every manifest in some directories, then deletes the chunks nothing refers to
+     * (left behind by a crash between writing chunks and their manifest).
+     *
+     * @param manifestDirectories Directories holding every manifest that points into this store
+     */
+    void Rebuild(const std::vector<boost::filesystem::path> &manifestDirectories);
+
+    /**
+     * Total size of the stored chunks in bytes
+     */
+    std::uint64_t storedBytes();
+
+    /**
+     * Reads the chunk list of a manifest
+     *
+     * @param manifestPath The manifest
+     * @param size Total size of the data
+     * @param chunks Ids and sizes of the chunks in order
+     *
+     * @return Whether or not the manifest was valid
+     */
+    static bool ReadManifest(const boost::filesystem::path &manifestPath, std::uint64_t &size,
+                             std::vector<std::pair<std::string, std::uint64_t>> &chunks);
+};
@@ -14,6 +14,7 @@ struct VideoFormat;
 struct Frame;
 #pragma once
 #include <algorithm>
+#include <atomic>
 #include <bitset>
 #include <condition_variable>
 #include <cstdint>
@@ -44,6 +45,16 @@ struct Frame;
 
 #include "common/typedefs.h"
 
+#include "Benchmark.h"
+#include "BufferPool.h"
+#include "ChunkStore.h"
+#include "ForkSnapshot.h"
+#include "HistoryIndex.h"
+#include "InputMovie.h"
+#include "InputQueue.h"
+#include "RewindBuffer.h"
+#include "RomCache.h"
+#include "StateCodec.h"
 #include "LetsPlayProtocol.h"
 #include "LetsPlayServer.h"
 #include "LetsPlayUser.h"
@@ -73,6 +84,8 @@ enum class kEmuCommandType {
             UserConnect,
     /** Fast forward request **/
             FastForward,
+    /** Rewind request, value is how many seconds **/
+            Rewind,
 };
 
 
@@ -91,6 +104,11 @@ struct EmuCommand {
      *  Who, if anyone, generated the command
      */
     boost::optional<LetsPlayUserHdl> user_hdl;
+
+    /**
+     * Argument of the command, if it takes one
+     */
+    std::uint64_t value{0};
 };
 
 /**
@@ -133,6 +151,11 @@ struct EmulatorControllerProxy {
      * Pointer to the forbidden combos list
      */
     std::vector<std::bitset<16>>* forbiddenCombos;
+
+    /**
+     * Pointer to the queue that joypad updates go through
+     */
+    InputQueue *inputQueue{nullptr};
 };
 
 /**
@@ -301,6 +324,26 @@ namespace EmulatorController {
     void Run(const std::string &corePath, const std::string &romPath, LetsPlayServer *server,
              EmuID_t t_id, const std::string &description);
 
+    /**
+     * Loads the core and rom, registers with the server and applies the emulator's config. Called by Run and
+     * Benchmark before their loops.
+     *
+     * @return Whether or not the emulator is ready to run
+     */
+    bool Init(const std::string &corePath, const std::string &romPath, LetsPlayServer *server,
+              EmuID_t t_id, const std::string &description);
+
+    /**
+     * Runs a core as fast as possible with no connected users, optionally running each stage of the frame
+     * pipeline, then prints the framerate, time spent per stage and peak memory use.
+     *
+     * @param options What to run and which stages to enable
+     * @param server The server to use for config and jpeg encoding. Doesn't need to be running.
+     *
+     * @return The exit code for the process
+     */
+    int Benchmark(const BenchmarkOptions &options, LetsPlayServer *server);
+
     /**
      * Callback for when the libretro core sends extra info about the
      * environment.
@@ -312,6 +355,11 @@ namespace EmulatorController {
      */
     bool OnEnvironment(unsigned cmd, void *data);
 
+    /**
+     * OnEnvironment for the run-ahead second instance, which gets its own save directory
+     */
+    bool OnRunAheadEnvironment(unsigned cmd, void *data);
+
     /**
      * Called by the RetroArch core when the video updates.
      *
@@ -402,15 +450,82 @@ namespace EmulatorController {
     Frame GetFrame();
 
     /**
-     * Called by the server periodically to add to the emulator history
+     * Called by the server periodically to add to the emulator history. Only serializes the state (or forks, with
+     * forkSnapshots enabled), the rest is queued on the server's IO worker.
      */
     void Save();
 
     /**
-     * Called by the server periodically to create a backup of saves and a single history state
+     * Writes a serialized state as the new current.state, moving the old one into the history and trimming it.
+     * Runs on the IO worker.
+     *
+     * @param t_server The server, for logging and config
+     * @param t_id ID of the emulator the state belongs to
+     * @param t_dataDirectory Data directory of the emulator
+     * @param store Chunk store of the emulator
+     * @param index History index of the emulator
+     * @param state The serialized state
+     * @param size Size of the state
+     */
+    void WriteState(LetsPlayServer *t_server, const EmuID_t &t_id, const boost::filesystem::path &t_dataDirectory,
+                    ChunkStore &store, HistoryIndex &index, const std::uint8_t *state, size_t size);
+
+    /**
+     * Reads a history entry, either a chunk store manifest or a self-contained .state
+     *
+     * @param store Chunk store of the emulator
+     * @param entry Path of the entry
+     * @param state Where to put the decoded state
+     *
+     * @return Whether or not the entry could be read
+     */
+    bool ReadHistoryState(ChunkStore &store, const boost::filesystem::path &entry, std::vector<std::uint8_t> &state);
+
+    /**
+     * Called by the server periodically to create a backup of saves and a single history state. The copying is
+     * queued on the server's IO worker.
      */
     void Backup();
 
+    /**
+     * Copies the save directory into a new backup and snapshots the current state into the chunk store. Files that
+     * haven't changed since the previous backup are hard links to it, so a backup only costs what changed. Runs on
+     * the IO worker.
+     *
+     * @param t_dataDirectory Data directory of the emulator
+     * @param t_saveDirectory Save directory of the emulator
+     * @param store Chunk store of the emulator
+     */
+    void WriteBackup(const boost::filesystem::path &t_dataDirectory, const boost::filesystem::path &t_saveDirectory,
+                     ChunkStore &store);
+
+    /**
+     * Recursively backs up a directory, hard linking files that are unchanged since the previous backup and copying
+     * the rest
+     *
+     * @param src Directory or file to back up
+     * @param dst Where to put it in the new backup
+     * @param previous The same path in the previous backup, which might not exist
+     * @param previousTime When the previous backup was started
+     */
+    void BackupIncremental(const boost::filesystem::path &src, const boost::filesystem::path &dst,
+                           const boost::filesystem::path &previous, std::time_t previousTime);
+
+    /**
+     * Whether or not a file in the previous backup has the same contents as the file being backed up. Size and
+     * modification time are checked first, the contents are only hashed if the times differ or are too close to when
+     * the previous backup was taken to be trusted.
+     */
+    bool SameFile(const boost::filesystem::path &a, const boost::filesystem::path &b, std::time_t previousTime);
+
+    /**
+     * Copies a file, as a copy-on-write clone if the filesystem supports it. Keeps the modification time so the next
+     * backup can tell whether it changed.
+     *
+     * @throws boost::filesystem::filesystem_error If the file couldn't be copied
+     */
+    void CloneFile(const boost::filesystem::path &src, const boost::filesystem::path &dst);
+
     /**
      * Called by the server. Toggles fast forward state.
      */
@@ -420,4 +535,65 @@ namespace EmulatorController {
      * Called on emulator controller startup, tries to load save state if possible
      */
     void Load();
+
+    /**
+     * Runs one emulator frame. If run-ahead is enabled, also runs the hidden frames ahead of it so that the video
+     * buffer holds the frame the core would show runAhead frames from now.
+     *
+     * @note RestoreRunAhead must be called after the frame is consumed.
+     */
+    void RunFrame();
+
+    /**
+     * Runs one real frame on the core, recording or replaying the input for it if enabled.
+     */
+    void StepFrame();
+
+    /**
+     * Adds the current state to the rewind buffer
+     */
+    void CaptureRewind();
+
+    /**
+     * Called by the server. Goes back to the state from some seconds ago, using the rewind buffer.
+     *
+     * @param seconds How far back to go
+     */
+    void Rewind(std::uint64_t seconds);
+
+    /**
+     * Starts recording the joypad to dataDirectory / movies, starting from the current state.
+     */
+    void StartRecording();
+
+    /**
+     * Loads a movie's starting state and replays its input from the next frame on, ignoring the joypad.
+     *
+     * @param moviePath Path to a movie written by StartRecording
+     *
+     * @return Whether or not the movie was loaded
+     */
+    bool StartReplay(const std::string &moviePath);
+
+    /**
+     * Runs a batch of frames in one tick while fast forwarding, only showing the last one. The size of the batch
+     * adapts to how much of the tick is left over, up to the configured maximum multiplier.
+     */
+    void RunFastForward();
+
+    /**
+     * Rolls the core back to the state saved by RunFrame, undoing the speculative frames. No-op if run-ahead
+     * didn't run this frame or is using a second instance.
+     */
+    void RestoreRunAhead();
+
+    /**
+     * Loads a second copy of the core and game used to run the speculative frames, so that the primary core
+     * never has to be rolled back.
+     *
+     * @param info The game info the primary core was loaded with
+     *
+     * @return Whether or not the second instance was loaded
+     */
+    bool LoadRunAheadInstance(const retro_game_info *info);
 }
@@ -0,0 +1,76 @@
+/**
+ * @file ForkSnapshot.h
+ *
+ * @author ctrlaltf2
+ *
+ *  @section DESCRIPTION
+ *  Serializes save states in a forked child so that the emulator thread only pays for the fork.
+ */
+
+class ForkSnapshot;
+
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+
+#include <sys/types.h>
+
+/**
+ * @class ForkSnapshot
+ *
+ * A save state being serialized by a forked copy of the process. The child sees the emulator exactly as it was when
+ * Start was called (the kernel copies pages lazily as the parent writes to them), serializes into memory shared with
+ * the parent and exits. The parent keeps running and picks the result up later with Wait.
+ *
+ * Only the forking thread exists in the child, so a core that needs a lock another thread was holding at the time of
+ * the fork would hang there. Wait's timeout is what catches that.
+ */
+class ForkSnapshot {
+    /**
+     * Shared mapping the child writes the state into
+     */
+    std::uint8_t *m_buffer{nullptr};
+    size_t m_size;
+
+    /**
+     * The child, or -1 once it's been reaped
+     */
+    pid_t m_child{-1};
+
+    explicit ForkSnapshot(size_t size);
+
+  public:
+    /**
+     * Forks and serializes in the child
+     *
+     * @param size Size of the state
+     * @param serialize Called in the child to serialize into a buffer of size bytes, returns whether it worked
+     *
+     * @return The snapshot, or nullptr if forking isn't possible (no memory, or an unsupported platform)
+     */
+    static std::unique_ptr<ForkSnapshot> Start(size_t size, const std::function<bool(void *, size_t)> &serialize);
+
+    /**
+     * Waits for the child to finish. Kills it if it takes too long.
+     *
+     * @param timeout Longest to wait
+     * @param timedOut Set to whether the child had to be killed
+     *
+     * @return Whether the child serialized the state successfully
+     */
+    bool Wait(std::chrono::milliseconds timeout, bool &timedOut);
+
+    const std::uint8_t *data() const;
+
+    size_t size() const;
+
+    ForkSnapshot(const ForkSnapshot &) = delete;
+    ForkSnapshot &operator=(const ForkSnapshot &) = delete;
+
+    /**
+     * Kills the child if it's still running and unmaps the buffer
+     */
+    ~ForkSnapshot();
+};
@@ -0,0 +1,91 @@
+/**
+ * @file HistoryIndex.h
+ *
+ * @author ctrlaltf2
+ *
+ *  @section DESCRIPTION
+ *  In-memory list of an emulator's history entries, so saving doesn't have to scan the history directory.
+ */
+
+struct HistoryEntry;
+class HistoryIndex;
+
+#pragma once
+#include <cstdint>
+#include <ctime>
+#include <deque>
+#include <mutex>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+
+/**
+ * @struct HistoryEntry
+ */
+struct HistoryEntry {
+    /**
+     * The state (.state) or chunk store manifest (.manifest)
+     */
+    boost::filesystem::path path;
+
+    /**
+     * When it was saved
+     */
+    std::time_t time;
+
+    /**
+     * Size of the state it holds, before compression or deduplication
+     */
+    std::uint64_t size;
+};
+
+/**
+ * @class HistoryIndex
+ *
+ * Entries of one history directory, oldest first. Read from disk once with Load, then kept up to date by whoever
+ * writes the history. Thread-safe.
+ */
+class HistoryIndex {
+    std::deque<HistoryEntry> m_entries;
+
+    /**
+     * Sum of the sizes of m_entries
+     */
+    std::uint64_t m_totalSize{0};
+
+    /**
+     * Mutex for m_entries and m_totalSize
+     */
+    std::mutex m_mutex;
+
+  public:
+    /**
+     * Replaces the index with the entries in a history directory, excluding current.state
+     *
+     * @param historyDirectory The directory to read
+     */
+    void Load(const boost::filesystem::path &historyDirectory);
+
+    /**
+     * Adds an entry newer than every other
+     */
+    void Add(const HistoryEntry &entry);
+
+    /**
+     * Drops the oldest entries until the history fits the limits. A limit of 0 means no limit.
+     *
+     * @param maxCount Most entries to keep
+     * @param maxSize Most total bytes to keep
+     * @param maxAge Oldest an entry can be, in seconds
+     * @param now The current time
+     *
+     * @return The dropped entries, which the caller has to delete
+     */
+    std::vector<HistoryEntry> Trim(std::uint64_t maxCount, std::uint64_t maxSize, std::uint64_t maxAge,
+                                   std::time_t now);
+
+    /**
+     * Copy of every entry, oldest first
+     */
+    std::vector<HistoryEntry> entries();
+};
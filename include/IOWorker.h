@@ -0,0 +1,178 @@
+/**
+ * @file IOWorker.h
+ *
+ * @author ctrlaltf2
+ *
+ */
+class IOWorker;
+
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Logging.hpp"
+
+/**
+ * @class IOWorker
+ *
+ * Background threads for disk work (writing states, history retention, backups) so that it doesn't stall the
+ * emulator threads. Jobs with the same key run one at a time in the order they were queued, jobs with different keys
+ * can run at the same time on different threads.
+ */
+class IOWorker {
+    /**
+     * A queued job
+     */
+    struct Job {
+        std::function<void()> run;
+
+        /**
+         * Jobs with the same non-empty key are never run at the same time or out of order
+         */
+        std::string key;
+
+        /**
+         * Roughly how many bytes the job writes, for the rate limit
+         */
+        std::uint64_t bytes;
+
+        /**
+         * When the job was queued
+         */
+        std::chrono::steady_clock::time_point queued;
+    };
+
+    /**
+     * Threads the jobs run on
+     */
+    std::vector<std::thread> m_threads;
+
+    /**
+     * Jobs waiting to be run
+     */
+    std::deque<Job> m_jobs;
+
+    /**
+     * Keys of the jobs running right now
+     */
+    std::multiset<std::string> m_activeKeys;
+
+    /**
+     * Mutex for everything but the rate limit
+     */
+    std::mutex m_mutex;
+
+    /**
+     * Notified when a job is queued, a job finishes or the worker is stopped
+     */
+    std::condition_variable m_notifier;
+
+    /**
+     * Notified when the queue empties and no job is running
+     */
+    std::condition_variable m_idleNotifier;
+
+    /**
+     * If false, the worker finishes the queued jobs and exits
+     */
+    bool m_running{true};
+
+    /**
+     * How many jobs are running
+     */
+    unsigned m_busy{0};
+
+    /**
+     * Longest a job has waited in the queue since the last call to TakeMaxLag
+     */
+    std::chrono::milliseconds m_maxLag{0};
+
+    /**
+     * Jobs that wait longer than this are logged. 0 to never log them.
+     */
+    std::chrono::milliseconds m_lagWarning{0};
+
+    /**
+     * Token bucket limiting bytes written per second, 0 for no limit. Tokens can go negative, which is how long later
+     * jobs have to wait.
+     */
+    std::uint64_t m_bytesPerSecond{0};
+    double m_tokens{0};
+    std::chrono::steady_clock::time_point m_lastRefill;
+
+    /**
+     * Mutex for the token bucket
+     */
+    std::mutex m_throttleMutex;
+
+    /**
+     * Where job failures are reported
+     */
+    Logger &m_logger;
+
+    /**
+     * Main loop of each of m_threads
+     */
+    void WorkerThread();
+
+    /**
+     * Finds the oldest job that can run now
+     *
+     * @return m_jobs.end() if every queued job's key is busy
+     */
+    std::deque<Job>::iterator NextRunnable();
+
+    /**
+     * Sleeps until the rate limit allows writing some bytes
+     *
+     * @param bytes How many bytes are about to be written
+     */
+    void Throttle(std::uint64_t bytes);
+
+  public:
+    explicit IOWorker(Logger &logger);
+
+    /**
+     * Changes how many threads run jobs and how fast they may write
+     *
+     * @param threads How many jobs can run at once. Can only be raised.
+     * @param bytesPerSecond Limit on bytes written per second across every thread, 0 for no limit
+     * @param lagWarning Jobs that wait in the queue longer than this get logged, 0 to never log them
+     */
+    void Configure(unsigned threads, std::uint64_t bytesPerSecond, std::chrono::milliseconds lagWarning);
+
+    /**
+     * Queues a job. Jobs run on a worker thread, so they must not touch any emulator thread_local state.
+     *
+     * @param job The job to run
+     * @param key Jobs with the same key run in order, one at a time. Empty means the job can run alongside anything.
+     * @param bytes Roughly how many bytes the job writes, counted against the rate limit before it runs
+     */
+    void Queue(std::function<void()> job, const std::string &key = "", std::uint64_t bytes = 0);
+
+    /**
+     * Gets the longest time a job waited in the queue before running, and resets it
+     */
+    std::chrono::milliseconds TakeMaxLag();
+
+    /**
+     * Blocks until every job queued so far has run
+     */
+    void Flush();
+
+    /**
+     * Runs the remaining jobs and joins the worker threads. Jobs queued afterwards are run on the caller's thread.
+     */
+    void Stop();
+
+    ~IOWorker();
+};
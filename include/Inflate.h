@@ -0,0 +1,136 @@
+/**
+ * @file Inflate.h
+ *
+ * @author ctrlaltf2
+ *
+ *  @section DESCRIPTION
+ *  Streaming decoder for raw deflate (RFC 1951) data, plus the CRC-32 zip files check it against.
+ */
+
+class Inflater;
+
+#pragma once
+#include <array>
+#include <cstdint>
+#include <istream>
+#include <ostream>
+#include <vector>
+
+/**
+ * @class Inflater
+ *
+ * Decodes a deflate stream from an istream into an ostream, keeping only the 32 KiB window in memory.
+ */
+class Inflater {
+    /**
+     * Canonical Huffman code
+     */
+    struct Huffman {
+        /**
+         * Bits looked up at once in fast
+         */
+        static constexpr unsigned fastBits{10};
+
+        /**
+         * How many codes have each length
+         */
+        std::array<std::uint16_t, 16> count;
+
+        /**
+         * Symbols ordered by code
+         */
+        std::array<std::uint16_t, 288> symbol;
+
+        /**
+         * (length << 9 | symbol) for codes of up to fastBits bits, indexed by the next fastBits input bits.
+         * 0 if the code is longer.
+         */
+        std::array<std::uint16_t, 1 << fastBits> fast;
+
+        /**
+         * Builds the code from a list of code lengths
+         *
+         * @return False if the lengths don't describe a valid code
+         */
+        bool Build(const std::uint8_t *lengths, unsigned n);
+    };
+
+    std::istream &m_in;
+    std::ostream &m_out;
+
+    /**
+     * Input read from m_in but not decoded yet
+     */
+    std::vector<std::uint8_t> m_input;
+    size_t m_inputPosition{0}, m_inputSize{0};
+
+    /**
+     * Bits read from m_input, least significant first
+     */
+    std::uint64_t m_bitBuffer{0};
+    unsigned m_bitCount{0};
+
+    /**
+     * Zero bytes added past the end of the input so that lookahead doesn't fail on short final codes
+     */
+    unsigned m_padding{0};
+
+    /**
+     * Decoded output. The last 32 KiB are kept for back references when it's flushed.
+     */
+    std::vector<std::uint8_t> m_window;
+    size_t m_windowPosition{0}, m_flushed{0};
+
+    /**
+     * Bytes decoded so far, and the most there are allowed to be
+     */
+    std::uint64_t m_total{0}, m_limit;
+
+    /**
+     * CRC-32 of everything flushed
+     */
+    std::uint32_t m_crc{0};
+
+    /**
+     * If the input was bad
+     */
+    bool m_failed{false};
+
+    Inflater(std::istream &in, std::ostream &out, std::uint64_t limit);
+
+    bool Fill(unsigned bits);
+    std::uint32_t Bits(unsigned bits);
+    int Decode(const Huffman &h);
+    void Put(std::uint8_t byte);
+    void Flush();
+
+    bool Stored();
+    bool Codes(const Huffman &lengthCode, const Huffman &distanceCode);
+    bool Fixed();
+    bool Dynamic();
+    bool Run();
+
+  public:
+    /**
+     * Decodes a raw deflate stream
+     *
+     * @param in Stream positioned at the start of the deflate data
+     * @param out Where to write the decoded data
+     * @param limit Most bytes the output may be, decoding fails past this
+     * @param crc CRC-32 of the decoded data
+     * @param size Size of the decoded data
+     *
+     * @return Whether or not the data was valid and was all written
+     */
+    static bool Inflate(std::istream &in, std::ostream &out, std::uint64_t limit, std::uint32_t &crc,
+                        std::uint64_t &size);
+
+    /**
+     * Continues a CRC-32 (the zip/gzip polynomial)
+     *
+     * @param crc CRC of the data so far, 0 to start
+     * @param data More data
+     * @param size Size of data
+     */
+    static std::uint32_t Crc32(std::uint32_t crc, const std::uint8_t *data, size_t size);
+};
@@ -0,0 +1,170 @@
+/**
+ * @file InputMovie.h
+ *
+ * @author ctrlaltf2
+ *
+ *  @section DESCRIPTION
+ *  Recording and replaying of the input given to an emulator.
+ */
+
+class InputRecorder;
+class InputReplay;
+
+#pragma once
+#include <array>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "RetroPad.h"
+
+/*
+ * Movie file format, all values little endian:
+ *
+ *  "LPMV"              magic
+ *  u8                  version (kInputMovieVersion)
+ *  u8[3]               reserved
+ *  u64                 size of the starting save state
+ *  u8[size]            starting save state
+ *  events...
+ *
+ * Each event is a LEB128 varint of how many frames passed since the previous event, a key byte with the
+ * RETRO_DEVICE_INDEX in the high nibble and the RETRO_DEVICE_ID in the low nibble, then the new value as an i16.
+ * A key byte of kInputMovieEnd ends the movie, its frame delta gives the movie length.
+ */
+
+/**
+ * Current version of the movie file format
+ */
+constexpr std::uint8_t kInputMovieVersion{1};
+
+/**
+ * Key byte marking the end of the movie
+ */
+constexpr std::uint8_t kInputMovieEnd{0xFF};
+
+/**
+ * @class InputRecorder
+ *
+ * Writes the changes to a RetroPad's values, sampled at frame boundaries, to a movie file.
+ */
+class InputRecorder {
+    /**
+     * The movie file being written
+     */
+    std::ofstream m_file;
+
+    /**
+     * Frame of the last written event
+     */
+    std::uint64_t m_lastEventFrame{0};
+
+    /**
+     * Last frame captured
+     */
+    std::uint64_t m_lastFrame{0};
+
+    /**
+     * Values written so far, in the order 16 buttons, left stick x/y, right stick x/y
+     */
+    std::array<std::int16_t, 20> m_values{};
+
+    /**
+     * Writes a single event
+     */
+    void writeEvent(std::uint64_t frame, unsigned index, unsigned id, std::int16_t value);
+
+  public:
+    /**
+     * Starts a movie
+     *
+     * @param path Where to write the movie
+     * @param state The save state the movie starts from
+     * @param stateSize Size of state
+     *
+     * @return Whether or not the file could be opened
+     */
+    bool Open(const std::string &path, const std::uint8_t *state, size_t stateSize);
+
+    /**
+     * Whether or not a movie is being recorded
+     */
+    bool isOpen() const;
+
+    /**
+     * Records any values that changed since the last capture. Called right before the frame is run.
+     *
+     * @param frame Frame number relative to the start of the movie
+     * @param pad The pad to sample
+     */
+    void Capture(std::uint64_t frame, RetroPad &pad);
+
+    /**
+     * Writes the end marker and closes the file
+     */
+    void Close();
+
+    ~InputRecorder();
+};
+
+/**
+ * @class InputReplay
+ *
+ * Reads a movie written by InputRecorder and applies it to a RetroPad frame by frame.
+ */
+class InputReplay {
+    /**
+     * The whole movie file, minus the header and state
+     */
+    std::vector<std::uint8_t> m_events;
+
+    /**
+     * Read position in m_events
+     */
+    size_t m_position{0};
+
+    /**
+     * Frame of the next event to apply
+     */
+    std::uint64_t m_nextFrame{0};
+
+    /**
+     * Whether or not the end marker (or end of file) was reached
+     */
+    bool m_finished{true};
+
+    /**
+     * Reads the frame delta of the next event, updating m_nextFrame. Marks the replay finished on bad data.
+     */
+    void readFrameDelta();
+
+  public:
+    /**
+     * Starting save state of the loaded movie
+     */
+    std::vector<std::uint8_t> state;
+
+    /**
+     * Loads a movie
+     *
+     * @param path The movie file
+     *
+     * @return Whether or not the movie was valid
+     */
+    bool Open(const std::string &path);
+
+    /**
+     * Applies every event for a frame to a pad. Called right before the frame is run.
+     *
+     * @param frame Frame number relative to the start of the movie
+     * @param pad The pad to update
+     */
+    void Apply(std::uint64_t frame, RetroPad &pad);
+
+    /**
+     * Whether or not the movie is over, meaning the last frame passed to Apply was the last one recorded. No more
+     * frames should be run after that for the replay to end in the recorded state.
+     */
+    bool finished() const;
+};
@@ -0,0 +1,119 @@
+/**
+ * @file InputQueue.h
+ *
+ * @author ctrlaltf2
+ *
+ *  @section DESCRIPTION
+ *  Queue of joypad updates that the emulator thread applies between frames.
+ */
+
+struct QueuedInput;
+class InputQueue;
+
+#pragma once
+#include <atomic>
+#include <bitset>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+#include "RetroPad.h"
+
+/**
+ * @struct QueuedInput
+ *
+ * One button or stick update waiting to be applied
+ */
+struct QueuedInput {
+    /**
+     * The RETRO_DEVICE_INDEX value
+     */
+    unsigned index;
+
+    /**
+     * The RETRO_DEVICE_ID value
+     */
+    unsigned id;
+
+    std::int16_t value;
+
+    /**
+     * When the update was received from the client
+     */
+    std::chrono::steady_clock::time_point received;
+};
+
+/**
+ * @class InputQueue
+ *
+ * Collects joypad updates from the network threads so that the emulator thread can apply them all at once before a
+ * frame, instead of the core seeing values change halfway through one. Updates are applied in the order they were
+ * received. Redundant updates to the same button or stick in one frame are coalesced into the last one, except that a
+ * button pressed and released within a frame stays pressed for that frame and is released on the next one.
+ *
+ * Push can be called from any thread, everything else only from the emulator thread.
+ */
+class InputQueue {
+    /**
+     * Updates pushed since the last Drain
+     */
+    std::vector<QueuedInput> m_incoming;
+
+    /**
+     * Mutex for m_incoming
+     */
+    std::mutex m_mutex;
+
+    /**
+     * The updates being applied by Drain. Kept around so that its memory is reused.
+     */
+    std::vector<QueuedInput> m_batch;
+
+    /**
+     * Updates held back to the next frame so that a press isn't released before the core sees it
+     */
+    std::vector<QueuedInput> m_deferred;
+
+    /**
+     * Most updates that can wait at once, more are dropped
+     */
+    size_t m_capacity;
+
+    std::atomic<std::uint64_t> m_coalesced{0};
+    std::atomic<std::uint64_t> m_dropped{0};
+
+  public:
+    explicit InputQueue(size_t capacity = 512);
+
+    /**
+     * Queues an update. Index and id have to be valid for a RetroPad.
+     *
+     * @return Whether there was room for it
+     */
+    bool Push(const QueuedInput &input);
+
+    /**
+     * Applies the queued updates to a pad. Called once per frame, before running it.
+     *
+     * @param pad The pad to update
+     * @param forbiddenCombos Button combos that can't all be pressed at once. Presses that would complete one are
+     * ignored.
+     */
+    void Drain(RetroPad &pad, const std::vector<std::bitset<16>> &forbiddenCombos);
+
+    /**
+     * Throws away every queued update, e.g. when the turn changes
+     */
+    void Clear();
+
+    /**
+     * Number of updates coalesced into a later one since the last call
+     */
+    std::uint64_t TakeCoalesced();
+
+    /**
+     * Number of updates dropped because the queue was full since the last call
+     */
+    std::uint64_t TakeDropped();
+};
@@ -0,0 +1,248 @@
+/**
+ * @file LaneExecutor.h
+ *
+ * @author ctrlaltf2
+ *
+ */
+template<typename Item>
+class LaneExecutor;
+
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * @class LaneExecutor
+ *
+ * Runs items on a pool of threads, split into named lanes. Items in the same lane are handled one at a time in the
+ * order they were posted, items in different lanes run in parallel. A busy lane only holds up itself: after each item
+ * its lane goes to the back of the line, so the other lanes get a turn.
+ *
+ * Posting only takes a short lock to queue the item, it never waits for an item to be handled.
+ */
+template<typename Item>
+class LaneExecutor {
+    struct Entry {
+        Item item;
+
+        /**
+         * When the item was posted
+         */
+        std::chrono::steady_clock::time_point queued;
+    };
+
+    struct Lane {
+        std::deque<Entry> entries;
+
+        /**
+         * Whether the lane is in m_ready or one of its items is being handled
+         */
+        bool scheduled{false};
+
+        /*
+         * Stats since the last TakeStats
+         */
+        size_t maxDepth{0};
+        std::uint64_t handled{0};
+        std::chrono::nanoseconds totalLatency{0};
+        std::chrono::nanoseconds maxLatency{0};
+    };
+
+    /**
+     * Every lane that has been posted to since the last TakeStats, or still has items
+     */
+    std::map<std::string, Lane> m_lanes;
+
+    /**
+     * Lanes with items waiting and nothing being handled, in the order they get a thread
+     */
+    std::deque<Lane *> m_ready;
+
+    std::vector<std::thread> m_threads;
+
+    /**
+     * Mutex for everything above
+     */
+    std::mutex m_mutex;
+
+    /**
+     * Notified when a lane becomes ready or the executor is stopped
+     */
+    std::condition_variable m_notifier;
+
+    bool m_running{false};
+
+    std::function<void(Item &)> m_handler;
+
+    /**
+     * Main loop of each of m_threads
+     */
+    void WorkerThread() {
+        std::unique_lock<std::mutex> lk(m_mutex);
+        while (true) {
+            m_notifier.wait(lk, [&]() { return !m_ready.empty() || !m_running; });
+            if (!m_running)
+                return;
+
+            Lane &lane = *m_ready.front();
+            m_ready.pop_front();
+
+            Entry entry = std::move(lane.entries.front());
+            lane.entries.pop_front();
+
+            lk.unlock();
+            m_handler(entry.item);
+            const auto latency = std::chrono::steady_clock::now() - entry.queued;
+
+            // Destroy the item before taking the lock again, in case that's expensive
+            { Item finished = std::move(entry.item); }
+            lk.lock();
+
+            ++lane.handled;
+            lane.totalLatency += latency;
+            lane.maxLatency = std::max<std::chrono::nanoseconds>(lane.maxLatency, latency);
+
+            if (!lane.entries.empty() && m_running) {
+                m_ready.push_back(&lane);
+                m_notifier.notify_one();
+            } else {
+                lane.scheduled = false;
+            }
+        }
+    }
+
+  public:
+    struct LaneStats {
+        std::string lane;
+
+        /**
+         * Items waiting right now
+         */
+        size_t depth;
+
+        /**
+         * Most items that were waiting at once
+         */
+        size_t maxDepth;
+
+        std::uint64_t handled;
+
+        /**
+         * Time from being posted until it was done being handled
+         */
+        std::chrono::nanoseconds averageLatency;
+        std::chrono::nanoseconds maxLatency;
+    };
+
+    /**
+     * Starts the threads
+     *
+     * @param threads How many items can be handled at once
+     * @param handler Called on a worker thread for every item
+     */
+    void Start(unsigned threads, std::function<void(Item &)> handler) {
+        std::unique_lock<std::mutex> lk(m_mutex);
+        if (m_running)
+            return;
+
+        m_running = true;
+        m_handler = std::move(handler);
+        for (unsigned i = 0; i < std::max(threads, 1u); ++i)
+            m_threads.emplace_back(&LaneExecutor::WorkerThread, this);
+    }
+
+    /**
+     * Queues an item. Dropped if the executor isn't running.
+     *
+     * @param lane The lane to handle it in
+     * @param item The item
+     */
+    void Post(const std::string &lane, Item item) {
+        std::unique_lock<std::mutex> lk(m_mutex);
+        if (!m_running)
+            return;
+
+        Lane &target = m_lanes[lane];
+        target.entries.push_back(Entry{std::move(item), std::chrono::steady_clock::now()});
+        target.maxDepth = std::max(target.maxDepth, target.entries.size());
+
+        if (!target.scheduled) {
+            target.scheduled = true;
+            m_ready.push_back(&target);
+            lk.unlock();
+            m_notifier.notify_one();
+        }
+    }
+
+    /**
+     * Gets the stats of every lane used since the last call and resets them. Lanes with nothing left to do are
+     * forgotten.
+     */
+    std::vector<LaneStats> TakeStats() {
+        std::vector<LaneStats> stats;
+
+        std::unique_lock<std::mutex> lk(m_mutex);
+        for (auto it = m_lanes.begin(); it != m_lanes.end();) {
+            auto &lane = it->second;
+
+            const auto average = lane.handled ? lane.totalLatency / static_cast<std::int64_t>(lane.handled)
+                                              : std::chrono::nanoseconds(0);
+            stats.push_back(LaneStats{it->first, lane.entries.size(), lane.maxDepth, lane.handled, average,
+                                      lane.maxLatency});
+
+            if (lane.entries.empty() && !lane.scheduled) {
+                it = m_lanes.erase(it);
+                continue;
+            }
+
+            lane.maxDepth = lane.entries.size();
+            lane.handled = 0;
+            lane.totalLatency = lane.maxLatency = std::chrono::nanoseconds(0);
+            ++it;
+        }
+
+        return stats;
+    }
+
+    /**
+     * Drops every waiting item and joins the threads after they finish what they're handling. Safe to call from a
+     * handler, in which case that thread is left to finish on its own.
+     */
+    void Stop() {
+        std::vector<std::thread> threads;
+        std::vector<Entry> dropped;
+        {
+            std::unique_lock<std::mutex> lk(m_mutex);
+            m_running = false;
+            m_ready.clear();
+            for (auto &lane : m_lanes) {
+                for (auto &entry : lane.second.entries)
+                    dropped.push_back(std::move(entry));
+                lane.second.entries.clear();
+            }
+            threads.swap(m_threads);
+        }
+
+        m_notifier.notify_all();
+
+        for (auto &thread : threads) {
+            if (thread.get_id() == std::this_thread::get_id())
+                thread.detach();
+            else if (thread.joinable())
+                thread.join();
+        }
+    }
+
+    ~LaneExecutor() {
+        Stop();
+    }
+};
@@ -73,6 +73,11 @@ class LetsPlayConfig {
      */
     void SaveConfig();
 
+    /**
+     * Stops writing the config to the disk, so that later changes only last as long as the process
+     */
+    void Detach();
+
     ~LetsPlayConfig();
 
     // 1
@@ -94,6 +99,26 @@ class LetsPlayConfig {
         }
     }
 
+    /**
+     * Gets a per-emulator config value. Emulator configs are copied from the template when an emulator is first
+     * created, so keys added after that fall back on the template instead of the (per-id, nonexistent) default.
+     *
+     * @param expectedType The json type the value should be
+     * @param id The emulator ID
+     * @param k The keys under config["serverConfig"]["emulators"][id]
+     */
+    template<typename ReturnType, typename... Keys>
+    ReturnType getEmu(nlohmann::json::value_t expectedType, const std::string& id, Keys... k) {
+        {
+            std::lock_guard<std::shared_timed_mutex> lk(mutex);
+            const nlohmann::json j = get(config["serverConfig"]["emulators"][id], k...);
+            if (j.type() == expectedType)
+                return j.get<ReturnType>();
+        }
+
+        return get<ReturnType>(expectedType, "serverConfig", "emulators", "template", k...);
+    }
+
     // 2, n-1
     template<typename... Keys>
     nlohmann::json &get(nlohmann::json &j, std::string key, Keys... k) {
@@ -10,10 +10,15 @@
 class LetsPlayProtocol;
 
 #pragma once
+#include <array>
+#include <cstdint>
 #include <sstream>
 #include <string>
+#include <type_traits>
 #include <vector>
 
+#include <boost/utility/string_view.hpp>
+
 /**
  * @class LetsPlayProtocol
  *
@@ -22,9 +27,70 @@ class LetsPlayProtocol;
  * Each item is preceded by its string length, followed by a '.', followed by the
  * string. If more items succeed the 'chunk', a comma is next. Otherwise, a semicolon
  * ends the message. An example would be <i>7.connect,4.emu1;</i>
+ *
+ * Input can also be sent as a binary message, see decodeInput.
  */
 class LetsPlayProtocol {
   public:
+    /**
+     * Type byte of a binary input message
+     */
+    static constexpr std::uint8_t inputMessageType = 0;
+
+    /**
+     * Most chunks a message can have, enough for every command the server accepts
+     */
+    static constexpr std::size_t maxChunks = 8;
+
+    /**
+     * Decoded chunks of a message, viewing into the message they were decoded from
+     */
+    using Chunks = std::array<boost::string_view, maxChunks>;
+
+    /**
+     * Most events one binary input message can hold
+     */
+    static constexpr std::size_t maxInputEvents = 64;
+
+    /**
+     * @struct InputEvent
+     *
+     * One button or stick change from a binary input message
+     */
+    struct InputEvent {
+        /**
+         * 0 for a button, 1 for the left stick, 2 for the right stick
+         */
+        std::uint8_t device;
+
+        /**
+         * RETRO_DEVICE_ID_JOYPAD id for buttons, RETRO_DEVICE_ID_ANALOG_X/Y for sticks
+         */
+        std::uint8_t id;
+
+        std::int16_t value;
+    };
+
+    /**
+     * @struct InputBatch
+     *
+     * A decoded binary input message
+     */
+    struct InputBatch {
+        /**
+         * Client's clock when the batch was sent, in milliseconds. Only meaningful relative to other batches from
+         * the same client.
+         */
+        std::uint32_t timestamp;
+
+        /**
+         * Number of used entries in events
+         */
+        std::size_t count;
+
+        std::array<InputEvent, maxInputEvents> events;
+    };
+
     /**
      * Vector-based function for encoding messages
      *
@@ -34,63 +100,53 @@ class LetsPlayProtocol {
      */
     static std::string encode(const std::vector<std::string>& chunks);
 
+    /**
+     * Vector-based function for encoding messages into an existing string, reusing its memory
+     *
+     * @param encoded Replaced with the encoded message
+     * @param chunks The 'chunks' of information to stich together.
+     */
+    static void encodeInto(std::string& encoded, const std::vector<std::string>& chunks);
+
     /**
      * Variadic function for encoding messages.
      *
-     * @note Wraps around encodeImpl.
-     * @note Data types that go into this function must have << overloaded
-     * for output streams.
+     * @note Wraps around encodeInto.
+     * @note Data types that go into this function must be strings, integers, bools or have << overloaded for output
+     * streams.
      *
      * @return The encoded string
-     *
-     *
      */
     template<typename Head, typename... Tail>
-    static std::string encode(Head h, Tail... t) {
+    static std::string encode(const Head& h, const Tail&... t) {
         std::string encoded;
-        encodeImpl(encoded, h, t...);
-        encoded.back() = ';';
+        encodeInto(encoded, h, t...);
         return encoded;
     }
 
     /**
-     * Base case for the encode variadic implementation
+     * Variadic function for encoding messages into an existing string, reusing its memory. The size of the message is
+     * worked out first, so it's written with a single allocation at most.
      *
-     * @param encoded The running encoded string
-     * @param item The item being looked at
+     * @param encoded Replaced with the encoded message
      *
-     * @note Data types that go into this function must have << overloaded
-     * for output streams.
+     * @note Data types that go into this function must be strings, integers, bools or have << overloaded for output
+     * streams.
      */
-    template<typename T>
-    static void encodeImpl(std::string& encoded, const T& item) {
-        // Convert item to a string
-        std::ostringstream toString;
-        toString << item;
-        const std::string itemAsString = toString.str();
+    template<typename Head, typename... Tail>
+    static void encodeInto(std::string& encoded, const Head& h, const Tail&... t) {
+        const std::array<Field, 1 + sizeof...(Tail)> fields{{Field(h), Field(t)...}};
 
-        // Append the item string size to the output
-        encoded += std::to_string(itemAsString.size());
-        encoded += '.';
-        // Append the item to the output
-        encoded += itemAsString;
-        encoded += ',';
-    }
+        size_t size{0};
+        for (const auto& field : fields)
+            size += encodedSize(field.view().size());
 
-    /**
-     * Recursive part of the variadic encode implementation
-     *
-     * @param encoded The running encoded string
-     * @param h The current item being looked at
-     * @param t The rest of the items being looked at
-     *
-     * @note Data types that go into this function must have << overloaded
-     * for output streams.
-     */
-    template<typename Head, typename... Tail>
-    static void encodeImpl(std::string& encoded, Head h, Tail... t) {
-        encodeImpl(encoded, h);
-        encodeImpl(encoded, t...);
+        encoded.resize(size);
+        char *out = &encoded[0];
+        for (const auto& field : fields)
+            out = writeChunk(out, field.view());
+
+        encoded.back() = ';';
     }
 
     /**
@@ -99,6 +155,134 @@ class LetsPlayProtocol {
      * @param input The encoded string to decode into multiple strings
      *
      * @return A list containing the decoded values, or empty if an invalid string.
+     *
+     * @note Wraps around the Chunks version, copying every chunk.
      */
     static std::vector<std::string> decode(const std::string& input);
+
+    /**
+     * Decodes a message in place, without allocating
+     *
+     * @param input The encoded message. Has to outlive chunks.
+     * @param chunks Filled with views of each chunk's contents
+     * @param maxLength Longest chunk to accept
+     *
+     * @return The number of chunks, or 0 if input is invalid or has more than maxChunks chunks.
+     */
+    static std::size_t decode(boost::string_view input, Chunks& chunks, std::size_t maxLength);
+
+    /**
+     * Decodes a binary input message. All integers are little endian:
+     *
+     * <pre>
+     * [u8 type = inputMessageType][u8 count][u32 timestamp]
+     * count times: [u8 device][u8 id][i16 value]
+     * </pre>
+     *
+     * so a single button press is 10 bytes instead of the ~20 of <i>6.button,1.4,5.32767;</i>
+     *
+     * @param input The message payload
+     * @param batch Where to decode into
+     *
+     * @return Whether input was a well-formed input message. The contents of batch are undefined if not.
+     */
+    static bool decodeInput(const std::string& input, InputBatch& batch);
+
+  private:
+    /**
+     * @class Field
+     *
+     * Text of one item being encoded. Strings are referred to, numbers are formatted into the field itself and
+     * anything else goes through an ostringstream.
+     */
+    class Field {
+        boost::string_view m_view;
+
+        /**
+         * Formatted integer, right aligned
+         */
+        std::array<char, 24> m_digits;
+        std::uint8_t m_digitsStart{0};
+
+        std::string m_other;
+
+        enum { View, Digits, Other } m_kind{View};
+
+        void assign(boost::string_view item) { m_view = item; }
+
+        void assign(const std::string& item) { m_view = item; }
+
+        void assign(const char *item) { m_view = item; }
+
+        void assign(bool item) { m_view = item ? "1" : "0"; }
+
+        void assign(char item) {
+            m_kind = Digits;
+            m_digitsStart = m_digits.size() - 1;
+            m_digits.back() = item;
+        }
+
+        template<typename T>
+        typename std::enable_if<std::is_integral<T>::value>::type assign(T item) {
+            using Unsigned = typename std::make_unsigned<T>::type;
+            const bool negative = isNegative(item);
+            auto magnitude = negative ? static_cast<Unsigned>(Unsigned(0) - static_cast<Unsigned>(item))
+                                      : static_cast<Unsigned>(item);
+
+            m_kind = Digits;
+            m_digitsStart = m_digits.size();
+            do {
+                m_digits[--m_digitsStart] = static_cast<char>('0' + magnitude % 10);
+                magnitude /= 10;
+            } while (magnitude);
+
+            if (negative)
+                m_digits[--m_digitsStart] = '-';
+        }
+
+        template<typename T>
+        typename std::enable_if<!std::is_integral<T>::value && !std::is_convertible<T, boost::string_view>::value>::type
+        assign(const T& item) {
+            std::ostringstream toString;
+            toString << item;
+            m_other = toString.str();
+            m_kind = Other;
+        }
+
+        template<typename T>
+        static typename std::enable_if<std::is_signed<T>::value, bool>::type isNegative(T item) { return item < 0; }
+
+        template<typename T>
+        static typename std::enable_if<!std::is_signed<T>::value, bool>::type isNegative(T) { return false; }
+
+      public:
+        template<typename T>
+        explicit Field(const T& item) { assign(item); }
+
+        boost::string_view view() const {
+            switch (m_kind) {
+                case Digits:
+                    return {m_digits.data() + m_digitsStart, m_digits.size() - m_digitsStart};
+                case Other:
+                    return m_other;
+                default:
+                    return m_view;
+            }
+        }
+    };
+
+    /**
+     * Size of a chunk with the given content size, including its length, period and separator
+     */
+    static size_t encodedSize(size_t contentSize);
+
+    /**
+     * Writes a chunk followed by a comma
+     *
+     * @param out Where to write, has to have room for encodedSize(content.size()) chars
+     * @param content The chunk's content
+     *
+     * @return The end of what was written
+     */
+    static char *writeChunk(char *out, boost::string_view content);
 };
@@ -5,10 +5,13 @@
  *
  */
 class LetsPlayServer;
+struct UserRegistry;
+enum class kEmuCommandType;
 
 #pragma once
 #include <algorithm>
 #include <atomic>
+#include <chrono>
 #include <condition_variable>
 #include <cstdint>
 #include <iterator>
@@ -37,11 +40,15 @@ class LetsPlayServer;
 
 #include "common/typedefs.h"
 #include "EmulatorController.h"
+#include "IOWorker.h"
+#include "LaneExecutor.h"
 #include "LetsPlayConfig.h"
 #include "LetsPlayProtocol.h"
 #include "LetsPlayUser.h"
 #include "Logging.hpp"
+#include "ObjectPool.h"
 #include "Random.h"
+#include "RomCache.h"
 #include "Scheduler.h"
 
 typedef websocketpp::server<websocketpp::config::asio> wcpp_server;
@@ -83,6 +90,8 @@ enum class kCommandType {
         Config,
     /** Fast forward toggle */
             FastForward,
+    /** Admin: rewind the emulator some seconds */
+            Rewind,
     /** Internal: Sends off previews to a user */
             Preview,
     Unknown,
@@ -100,6 +109,20 @@ enum kBinaryMessageType {
             Preview,
 };
 
+/**
+ * @enum kInputDevice
+ *
+ * Which part of the RetroPad an input update is for. Values match the device byte of binary input messages.
+ */
+enum class kInputDevice : std::uint8_t {
+    /** One of the 16 buttons */
+        Button,
+    /** The left analog stick */
+        LeftStick,
+    /** The right analog stick */
+        RightStick,
+};
+
 /**
  * @struct IPData
  *
@@ -166,6 +189,31 @@ struct Command {
     LetsPlayUserHdl user_hdl;
 };
 
+/**
+ * A Command borrowed from LetsPlayServer's pool, returned to it when destroyed
+ */
+using PooledCommand = ObjectPool<Command>::Handle;
+
+/**
+ * @struct UserRegistry
+ *
+ * Immutable copy of the user table. A new one is published whenever a user connects, disconnects or joins an
+ * emulator, so that broadcasting can read the current one without locking anything.
+ */
+struct UserRegistry {
+    using Subscriber = std::pair<websocketpp::connection_hdl, std::shared_ptr<LetsPlayUser>>;
+
+    /**
+     * Every connected user
+     */
+    std::vector<Subscriber> users;
+
+    /**
+     * Users connected to each emulator
+     */
+    std::map<EmuID_t, std::vector<Subscriber>> subscribers;
+};
+
 /**
  * @class LetsPlayServer
  *
@@ -173,29 +221,30 @@ struct Command {
  */
 class LetsPlayServer {
     /**
-     * Queue that holds the list of commands/actions to be executed
+     * Runs commands on a pool of threads, in one lane per emulator (by EmuID) plus serverLane for everything that
+     * isn't tied to an emulator
      */
-    std::queue<Command> m_WorkQueue;
+    LaneExecutor<PooledCommand> m_Lanes;
 
     /**
-     * Mutex for accessing m_WorkQueue
+     * Name of the lane for commands that aren't tied to an emulator
      */
-    std::mutex m_QueueMutex;
+    static const std::string serverLane;
 
     /**
-     * Thread that manages new commands/actions
+     * Recycled Commands, so that handling a message doesn't allocate once the pool has warmed up
      */
-    std::thread m_QueueThread;
+    ObjectPool<Command> m_CommandPool{256};
 
     /**
-     * If true, the QueueThread will keep running
+     * If false, the server is shutting down
      */
-    std::atomic<bool> m_QueueThreadRunning;
+    std::atomic<bool> m_Running{false};
 
     /**
-     * Condition variable that allows the queue to wait for new commands/actions
+     * Longest chunk accepted in a received message, set from maxMessageSize when the server starts
      */
-    std::condition_variable m_QueueNotifier;
+    size_t m_MaxChunkSize{999};
 
     /**
      * If true, the SaveThread will keep running
@@ -214,10 +263,31 @@ class LetsPlayServer {
         m_Users;
 
     /**
-     * Mutex for accessing m_Users
+     * Users connected to each emulator, so that sending to an emulator's viewers doesn't go through every user.
+     * Guarded by m_UsersMutex.
+     */
+    std::map<EmuID_t, std::map<websocketpp::connection_hdl, std::shared_ptr<LetsPlayUser>,
+                               std::owner_less<websocketpp::connection_hdl>>>
+        m_Subscribers;
+
+    /**
+     * Mutex for accessing m_Users and m_Subscribers, and for publishing m_Registry
      */
     std::mutex m_UsersMutex;
 
+    /**
+     * Snapshot of m_Users and m_Subscribers for broadcasting. Only read and replaced with std::atomic_load and
+     * std::atomic_store.
+     */
+    std::shared_ptr<const UserRegistry> m_Registry{std::make_shared<UserRegistry>()};
+
+    /**
+     * Publishes a new m_Registry from m_Users and m_Subscribers
+     *
+     * @note m_UsersMutex must be held
+     */
+    void PublishUsers();
+
     /**
      * All of the emulator controller threads
      */
@@ -234,6 +304,16 @@ class LetsPlayServer {
      */
     std::map<EmuID_t, EmulatorControllerProxy *> m_Emus;
 
+    /**
+     * Mutex for m_StaggerNotifier
+     */
+    std::mutex m_StaggerMutex;
+
+    /**
+     * Wakes up a staggered save or backup round early when the server is shutting down
+     */
+    std::condition_variable m_StaggerNotifier;
+
     /**
      * Make m_emus thread-safe
      */
@@ -279,6 +359,16 @@ public:
      */
     Scheduler scheduler;
 
+    /**
+     * Background thread for writing states and backups
+     */
+    IOWorker ioWorker{logger};
+
+    /**
+     * Roms mapped by the emulators
+     */
+    RomCache romCache;
+
     /*
      * ---- Filesystem constants ----
      */
@@ -303,6 +393,11 @@ public:
      */
     boost::filesystem::path coreDirectory;
 
+    /**
+     * Data dir / cache
+     */
+    boost::filesystem::path cacheDirectory;
+
 
     /**
      * Constructor
@@ -348,6 +443,44 @@ public:
      */
     void OnMessage(websocketpp::connection_hdl hdl, wcpp_server::message_ptr msg);
 
+    /**
+     * Gets a Command from the pool with no emulator or user set
+     * @param type The type of command
+     * @param hdl Who sent it
+     * @param paramCount How many params it has, left for the caller to fill in
+     */
+    PooledCommand MakeCommand(kCommandType type, websocketpp::connection_hdl hdl, size_t paramCount);
+
+    /**
+     * Handles a button command on the thread that received it, skipping the work queue
+     * @param command The button command
+     * @param received When the message was received
+     */
+    void OnButton(const Command& command, std::chrono::steady_clock::time_point received);
+
+    /**
+     * Handles a binary input message by applying it to the sender's emulator straight away, skipping the work queue
+     * @param hdl Who sent the message
+     * @param data The message payload
+     * @param received When the message was received
+     */
+    void OnInputMessage(websocketpp::connection_hdl hdl, const std::string& data,
+                        std::chrono::steady_clock::time_point received);
+
+    /**
+     * Queues a button or stick update for an emulator's joypad, applied before its next frame. Safe to call from any
+     * thread.
+     * @param emuID The emulator to update
+     * @param device Which part of the joypad to update
+     * @param id RETRO_DEVICE_ID_JOYPAD id for buttons, RETRO_DEVICE_ID_ANALOG_X/Y for sticks
+     * @param value The new value
+     * @param received When the update was received, for measuring input latency
+     *
+     * @return Whether the update was valid and queued
+     */
+    bool ApplyInput(const EmuID_t& emuID, kInputDevice device, std::int16_t id, std::int16_t value,
+                    std::chrono::steady_clock::time_point received);
+
     /**
      * Stops the main loop, closes all connections, and unbinds to the port.
      */
@@ -356,9 +489,19 @@ public:
     void Shutdown();
 
     /**
-     * Thread function that manages the queue and all of the incoming commands
+     * Queues a command in its lane
      */
-    void QueueThread();
+    void QueueCommand(PooledCommand command);
+
+    /**
+     * Runs a command. Called on one of m_Lanes' threads.
+     */
+    void ProcessCommand(Command &command);
+
+    /**
+     * Task function that logs how busy each command lane was
+     */
+    void LaneTask();
 
     /**
      * Task function that manages the ping sends and disconnects for users not responding with a pong
@@ -370,6 +513,19 @@ public:
      */
     void PreviewTask();
 
+    /**
+     * Frames a message once so that the same copy can be sent to every receiver of a broadcast. Server frames aren't
+     * masked, so a frame prepared here is written to each connection as-is.
+     *
+     * @param data The message
+     * @param size Size of the message
+     * @param op The type of frame to send
+     *
+     * @return The prepared message, or nullptr if it couldn't be framed
+     */
+    static wcpp_server::message_ptr PrepareMessage(const void *data, size_t size,
+                                                   websocketpp::frame::opcode::value op);
+
     /**
      * Send a message to all connected users
      * @param message The message to send (isn't modified or encoded on the way out)
@@ -427,6 +583,16 @@ public:
      */
     void BackupTask();
 
+    /**
+     * Pushes a command to every emulator. If staggering is enabled, the emulators are spread out over most of the
+     * period with some jitter instead of all getting it at once, so that their serialization and writes don't all
+     * land at the same moment.
+     *
+     * @param type The command to push
+     * @param period How often the task calling this runs
+     */
+    void StaggerEmuCommand(kEmuCommandType type, std::chrono::milliseconds period);
+
 
     // --- Functions called only by emulator controllers --- //
     /**
@@ -457,6 +623,13 @@ public:
      */
     std::vector<std::uint8_t> GenerateEmuJPEG(const EmuID_t &id);
 
+    /**
+     * Encodes a frame as a jpeg. The first byte of the output is left free for the binary message type.
+     *
+     * @param frame The frame to encode
+     */
+    std::vector<std::uint8_t> EncodeJPEG(const Frame &frame);
+
     /**
      * Replaces ~ in file paths with the path to the current user's home directory.
      * @param str
@@ -135,6 +135,11 @@ public:
      */
     void setUsername(const std::string& name);
 
+    /**
+     * Whether or not the user has picked a username, without copying it
+     */
+    bool hasUsername();
+
     /**
      * Get the uuid as a string
      */
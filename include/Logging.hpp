@@ -44,7 +44,13 @@ class Logger {
         std::chrono::time_point<std::chrono::system_clock> p = std::chrono::system_clock::now();
 
         std::time_t t = std::chrono::system_clock::to_time_t(p);
-        std::string ts = std::string(std::ctime(&t));
+        std::string ts;
+        {
+            // ctime returns a shared buffer, and there can be several network threads logging at once
+            static std::mutex ctimeMutex;
+            std::unique_lock<std::mutex> lk(ctimeMutex);
+            ts = std::ctime(&t);
+        }
 
         ts.back() = ']';
         ts.push_back('\t');
@@ -0,0 +1,89 @@
+/**
+ * @file ObjectPool.h
+ *
+ * @author ctrlaltf2
+ *
+ */
+template<typename T>
+class ObjectPool;
+
+#pragma once
+#include <memory>
+#include <mutex>
+#include <vector>
+
+/**
+ * @class ObjectPool
+ *
+ * Recycles objects that are created and thrown away often, so that they (and whatever memory they hold on to, like
+ * string capacity) don't have to be reallocated every time. Objects are handed out as move-only handles that return
+ * them to the pool when destroyed, on whatever thread that happens.
+ */
+template<typename T>
+class ObjectPool {
+    /**
+     * Free objects, shared with the handles' deleters so that handles can outlive the pool
+     */
+    struct Storage {
+        std::mutex mutex;
+        std::vector<std::unique_ptr<T>> objects;
+        size_t maxObjects;
+    };
+
+    std::shared_ptr<Storage> m_storage;
+
+  public:
+    /**
+     * Returns objects to the pool they came from, or deletes them if it's gone or full
+     */
+    class Deleter {
+        std::weak_ptr<Storage> m_storage;
+
+      public:
+        Deleter() = default;
+
+        explicit Deleter(std::weak_ptr<Storage> storage) : m_storage{std::move(storage)} {}
+
+        void operator()(T *object) const {
+            std::unique_ptr<T> owned(object);
+
+            auto storage = m_storage.lock();
+            if (!storage)
+                return;
+
+            std::unique_lock<std::mutex> lk(storage->mutex);
+            if (storage->objects.size() < storage->maxObjects)
+                storage->objects.push_back(std::move(owned));
+        }
+    };
+
+    using Handle = std::unique_ptr<T, Deleter>;
+
+    /**
+     * @param maxObjects How many free objects to keep around at most
+     */
+    explicit ObjectPool(size_t maxObjects = 64) : m_storage{std::make_shared<Storage>()} {
+        m_storage->maxObjects = maxObjects;
+        m_storage->objects.reserve(maxObjects);
+    }
+
+    /**
+     * Gets an object. It's left however it was when it was last released, so the caller has to reset anything it
+     * doesn't overwrite.
+     */
+    Handle Acquire() {
+        std::unique_ptr<T> object;
+        {
+            std::unique_lock<std::mutex> lk(m_storage->mutex);
+            if (!m_storage->objects.empty()) {
+                object = std::move(m_storage->objects.back());
+                m_storage->objects.pop_back();
+            }
+        }
+
+        if (!object)
+            object = std::make_unique<T>();
+
+        return Handle(object.release(), Deleter(m_storage));
+    }
+};
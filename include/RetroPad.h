@@ -11,8 +11,10 @@ class RetroPad;
 #include <array>
 #include <atomic>
 #include <bitset>
+#include <chrono>
 #include <cmath>
 #include <cstdint>
+#include <vector>
 
 #include "AnalogStick.h"
 #include "Button.h"
@@ -34,6 +36,17 @@ class RetroPad {
      */
     std::array<AnalogStick, 2> m_stickStates;
 
+    /**
+     * Which buttons are pressed, one bit per button. Kept next to m_buttonStates so that forbidden combos can be
+     * checked and applied in one compare-exchange.
+     */
+    std::atomic<std::uint16_t> m_pressedState{0};
+
+    /**
+     * When the oldest update the core hasn't read yet was received, in steady_clock ticks. 0 if there is none.
+     */
+    std::atomic<std::chrono::steady_clock::rep> m_pendingSince{0};
+
   public:
     /**
      * Checks if a button is pressed
@@ -56,6 +69,30 @@ class RetroPad {
      */
     void updateValue(unsigned index, unsigned id, std::int16_t value);
 
+    /**
+     * Sets a button's value, unless pressing it would complete a forbidden combo. Safe to call from several threads.
+     * @param id the RETRO_DEVICE_ID_JOYPAD id
+     * @param value the new value to set
+     * @param forbiddenCombos combos that can't all be pressed at once
+     *
+     * @return Whether the value was set
+     */
+    bool updateButton(unsigned id, std::int16_t value, const std::vector<std::bitset<16>> &forbiddenCombos);
+
+    /**
+     * Notes that an update received at some time was applied, for measuring input latency
+     * @param received when the update was received from the client
+     */
+    void markUpdated(std::chrono::steady_clock::time_point received);
+
+    /**
+     * Takes the receive time of the oldest update applied since the last call
+     * @param received set to the receive time, if there was an update
+     *
+     * @return Whether there was an update
+     */
+    bool takeUpdate(std::chrono::steady_clock::time_point &received);
+
     /**
      * Called between turns, resets all buttons to unpressed so that there's no stuck down buttons
      */
@@ -0,0 +1,100 @@
+/**
+ * @file RewindBuffer.h
+ *
+ * @author ctrlaltf2
+ *
+ *  @section DESCRIPTION
+ *  In-memory history of recent states for undoing things quickly.
+ */
+
+class RewindBuffer;
+
+#pragma once
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+#include "StateCodec.h"
+
+/**
+ * @class RewindBuffer
+ *
+ * Ring of states kept in one preallocated block of memory. The newest state is kept as is and every older state
+ * is stored as a StateCodec delta against the one after it, so rewinding walks back from the newest state and the
+ * oldest state can always be dropped to make room.
+ */
+class RewindBuffer {
+    /**
+     * Where an entry is in m_arena
+     */
+    struct Entry {
+        size_t offset;
+        size_t size;
+    };
+
+    /**
+     * Memory the entries are stored in, used as a ring
+     */
+    std::vector<std::uint8_t> m_arena;
+
+    /**
+     * Offset in m_arena right after the newest entry
+     */
+    size_t m_head{0};
+
+    /**
+     * Entries, oldest first
+     */
+    std::deque<Entry> m_entries;
+
+    /**
+     * The newest state
+     */
+    std::vector<std::uint8_t> m_latest;
+
+    /**
+     * If m_latest holds a state
+     */
+    bool m_hasLatest{false};
+
+    /**
+     * Reused buffers for encoding and decoding
+     */
+    std::vector<std::uint8_t> m_scratch, m_decoded;
+
+  public:
+    /**
+     * Empties the buffer and sets its size
+     *
+     * @param capacity Bytes of memory to keep states in, 0 to disable the buffer
+     */
+    void Reset(size_t capacity);
+
+    /**
+     * If the buffer has any memory
+     */
+    bool enabled() const;
+
+    /**
+     * Adds a state, dropping the oldest ones if there's no room
+     *
+     * @param state The state
+     * @param size Size of state
+     */
+    void Push(const std::uint8_t *state, size_t size);
+
+    /**
+     * How many states older than the newest one are stored
+     */
+    size_t depth() const;
+
+    /**
+     * Goes back a number of states, discarding the newer ones
+     *
+     * @param steps How many states back to go. Clamped to depth()
+     * @param state Where to put the state that's now the newest
+     *
+     * @return How many steps were actually taken, or -1 if there's no state at all
+     */
+    long Rewind(size_t steps, std::vector<std::uint8_t> &state);
+};
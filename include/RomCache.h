@@ -0,0 +1,162 @@
+/**
+ * @file RomCache.h
+ *
+ * @author ctrlaltf2
+ *
+ *  @section DESCRIPTION
+ *  Memory mapped roms shared between every emulator in the process, and the on-disk cache of roms extracted from
+ *  archives.
+ */
+
+class RomImage;
+class ExtractedRom;
+class RomCache;
+
+#pragma once
+#include <cstdint>
+#include <ctime>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+
+/**
+ * @class RomImage
+ *
+ * A mapped rom file. Stays mapped for as long as any copy of the shared_ptr holding it exists.
+ */
+class RomImage {
+    boost::interprocess::file_mapping m_file;
+    boost::interprocess::mapped_region m_region;
+
+  public:
+    /**
+     * Maps a file
+     *
+     * @param path The file
+     * @param copyOnWrite If true, writes go to private copies of the written pages instead of failing
+     *
+     * @throws boost::interprocess::interprocess_exception If the file can't be mapped
+     */
+    RomImage(const boost::filesystem::path &path, bool copyOnWrite);
+
+    void *data() const;
+
+    size_t size() const;
+};
+
+/**
+ * @class ExtractedRom
+ *
+ * A rom extracted into the cache. Its cache entry isn't evicted for as long as any copy of the shared_ptr holding it
+ * exists.
+ */
+class ExtractedRom {
+    boost::filesystem::path m_path;
+    boost::filesystem::path m_entryDirectory;
+
+  public:
+    /**
+     * @param path The file to give the core
+     * @param entryDirectory The cache entry it's in, along with the rest of the archive
+     */
+    ExtractedRom(boost::filesystem::path path, boost::filesystem::path entryDirectory);
+
+    const boost::filesystem::path &path() const;
+
+    const boost::filesystem::path &entryDirectory() const;
+};
+
+/**
+ * @class RomCache
+ *
+ * Hands out read-only mappings of roms, sharing one mapping between every emulator running the same file.
+ */
+class RomCache {
+    /**
+     * Canonical path, size and modification time, so that a rom changed on disk gets a new mapping
+     */
+    using Key = std::tuple<std::string, std::uintmax_t, std::time_t>;
+
+    /**
+     * Roms that are mapped right now
+     */
+    std::map<Key, std::weak_ptr<RomImage>> m_roms;
+
+    /**
+     * MD5 of every archive extracted from so far, so that starting from an unchanged archive doesn't read all of it
+     */
+    std::map<Key, std::string> m_archiveHashes;
+
+    /**
+     * Mutex for m_roms and m_archiveHashes
+     */
+    std::mutex m_mutex;
+
+    /**
+     * Every extracted rom handed out, so that entries still in use aren't evicted
+     */
+    std::vector<std::weak_ptr<ExtractedRom>> m_extracted;
+
+    /**
+     * Held while extracting or evicting so that two emulators starting from the same archive don't both extract it.
+     * Also the mutex for m_extracted.
+     */
+    std::mutex m_extractMutex;
+
+    /**
+     * Gets the key of a file
+     *
+     * @param path The file
+     * @param canonical Where to put the canonical path of the file
+     * @param key Where to put the key
+     *
+     * @return Whether or not the file exists and could be stat'd
+     */
+    static bool GetKey(const boost::filesystem::path &path, boost::filesystem::path &canonical, Key &key);
+
+    /**
+     * Deletes the least recently used extracted roms that aren't in use until the cache fits. Called with
+     * m_extractMutex held.
+     *
+     * @param cacheDirectory The extracted rom cache
+     * @param maxBytes Most bytes the cache may use
+     */
+    void Evict(const boost::filesystem::path &cacheDirectory, std::uintmax_t maxBytes);
+
+  public:
+    /**
+     * Gets a rom, mapping it if it isn't already
+     *
+     * @param path Path to the rom
+     * @param copyOnWrite If true, gives the caller its own copy-on-write mapping for cores that write to the rom
+     *
+     * @return The rom, or nullptr if it couldn't be mapped
+     */
+    std::shared_ptr<RomImage> Open(const boost::filesystem::path &path, bool copyOnWrite = false);
+
+    /**
+     * Gets the rom out of a zip archive, extracting the whole archive into the cache if it isn't there already, so
+     * that multi-file roms keep the files their descriptor names. Cache entries are
+     * keyed by the archive's hash, so a renamed archive still hits and a changed one doesn't. The hash is only
+     * recomputed when the archive's size or modification time changes.
+     *
+     * @param archive Path to the archive
+     * @param cacheDirectory Where extracted roms are kept
+     * @param maxBytes Most bytes the cache may use, least recently used roms are deleted past this
+     * @param validExtensions Rom extensions the core accepts, '|' separated. A descriptor (.m3u, .cue, .gdi, .ccd,
+     * .toc) with one of these is picked first, then the largest file with one of these, then the largest file.
+     * @param error Why it failed, if it did
+     *
+     * @return The extracted rom, which has to be kept for as long as the core may read it, or nullptr on failure
+     */
+    std::shared_ptr<ExtractedRom> Extract(const boost::filesystem::path &archive,
+                                          const boost::filesystem::path &cacheDirectory, std::uintmax_t maxBytes,
+                                          const std::string &validExtensions, std::string &error);
+};
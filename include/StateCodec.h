@@ -0,0 +1,135 @@
+/**
+ * @file StateCodec.h
+ *
+ * @author ctrlaltf2
+ *
+ *  @section DESCRIPTION
+ *  Compression for save states, either on their own (keyframes) or as a delta against another state.
+ */
+
+class StateCodec;
+
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+
+/*
+ * Encoded state format, all values little endian:
+ *
+ *  "LPST"      magic
+ *  u8          version (StateCodec::version)
+ *  u8          kStateKind
+ *  u8[2]       reserved
+ *  u64         size of the decoded state
+ *  u32         FNV-1a hash of the decoded state
+ *  payload
+ *
+ * The payload is a sequence of tokens, each a LEB128 varint of (length << 1 | isRun). A run is followed by the
+ * byte to repeat, a literal by length bytes. Keyframes encode the state itself, deltas encode the state XORed
+ * with a base state of the same size, which is mostly zeroes for consecutive states.
+ *
+ * Files without the magic are treated as raw states so that states written before the codec still load.
+ */
+
+/**
+ * @enum kStateKind
+ *
+ * What an encoded state needs to be decoded
+ */
+enum class kStateKind : std::uint8_t {
+    /** Raw state without a header */
+        Raw = 0,
+    /** Standalone compressed state */
+        Keyframe = 1,
+    /** Compressed XOR against a base state */
+        Delta = 2,
+};
+
+/**
+ * @class StateCodec
+ *
+ * Encodes and decodes states in the format above.
+ */
+class StateCodec {
+  public:
+    /**
+     * Current version of the format
+     */
+    static constexpr std::uint8_t version{1};
+
+    /**
+     * Size of the header in bytes
+     */
+    static constexpr size_t headerSize{20};
+
+    /**
+     * Largest decoded state accepted, far past anything a core saves, so that a corrupt size fails to decode
+     * instead of failing to allocate
+     */
+    static constexpr std::uint64_t maxStateSize{std::uint64_t{1} << 32};
+
+    /**
+     * Encodes a state on its own
+     *
+     * @param state The state to encode
+     * @param size Size of state
+     * @param out Where to write the encoded state, replacing its contents
+     */
+    static void EncodeKeyframe(const std::uint8_t *state, size_t size, std::vector<std::uint8_t> &out);
+
+    /**
+     * Encodes a state as a delta against a base state. Falls back to a keyframe if the sizes differ.
+     *
+     * @param state The state to encode
+     * @param base The state decoding will start from
+     * @param size Size of state
+     * @param baseSize Size of base
+     * @param out Where to write the encoded state, replacing its contents
+     */
+    static void EncodeDelta(const std::uint8_t *state, const std::uint8_t *base, size_t size, size_t baseSize,
+                            std::vector<std::uint8_t> &out);
+
+    /**
+     * Gets the kind of an encoded state
+     *
+     * @param data The encoded state
+     * @param size Size of data
+     */
+    static kStateKind Kind(const std::uint8_t *data, size_t size);
+
+    /**
+     * Decodes a state
+     *
+     * @param data The encoded state
+     * @param size Size of data
+     * @param base The base state, only needed for deltas
+     * @param out Where to write the decoded state, replacing its contents
+     *
+     * @return Whether or not the state was valid and matches its hash
+     */
+    static bool Decode(const std::uint8_t *data, size_t size, const std::vector<std::uint8_t> *base,
+                       std::vector<std::uint8_t> &out);
+
+    /**
+     * Reads a whole file
+     *
+     * @param path The file to read
+     * @param out Where to put the contents
+     *
+     * @return Whether or not the file could be read
+     */
+    static bool ReadFile(const boost::filesystem::path &path, std::vector<std::uint8_t> &out);
+
+    /**
+     * Writes a file through a temporary and a rename so that readers never see a partial file
+     *
+     * @param path The file to write
+     * @param data What to write
+     *
+     * @return Whether or not the file was written
+     */
+    static bool WriteFile(const boost::filesystem::path &path, const std::vector<std::uint8_t> &data);
+};
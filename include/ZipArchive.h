@@ -0,0 +1,85 @@
+/**
+ * @file ZipArchive.h
+ *
+ * @author ctrlaltf2
+ *
+ *  @section DESCRIPTION
+ *  Minimal zip reader for loading roms out of archives. Supports stored and deflated entries, and zip64.
+ */
+
+struct ZipEntry;
+class ZipArchive;
+
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+
+#include "Inflate.h"
+
+/**
+ * @struct ZipEntry
+ *
+ * A file in the archive, from the central directory
+ */
+struct ZipEntry {
+    /**
+     * Path inside the archive
+     */
+    std::string name;
+
+    /**
+     * 0 for stored, 8 for deflate
+     */
+    std::uint16_t method;
+
+    /**
+     * General purpose flags. Bit 0 means encrypted.
+     */
+    std::uint16_t flags;
+
+    std::uint32_t crc;
+    std::uint64_t compressedSize;
+    std::uint64_t size;
+
+    /**
+     * Where the entry's local header is in the archive
+     */
+    std::uint64_t localHeaderOffset;
+};
+
+/**
+ * @class ZipArchive
+ */
+class ZipArchive {
+    boost::filesystem::path m_path;
+
+    std::vector<ZipEntry> m_entries;
+
+  public:
+    /**
+     * Reads the central directory of an archive
+     *
+     * @param path The archive
+     *
+     * @return Whether or not it's a zip file that could be read
+     */
+    bool Open(const boost::filesystem::path &path);
+
+    /**
+     * Every file and directory in the archive
+     */
+    const std::vector<ZipEntry> &entries() const;
+
+    /**
+     * Decompresses an entry, checking its size and CRC
+     *
+     * @param entry The entry
+     * @param destination File to write it to
+     *
+     * @return Whether or not the entry was supported, intact and written
+     */
+    bool Extract(const ZipEntry &entry, const boost::filesystem::path &destination) const;
+};
@@ -0,0 +1,34 @@
+#include "BufferPool.h"
+
+BufferPool::BufferPool(size_t maxBuffers) : m_storage{std::make_shared<Storage>()} {
+    m_storage->maxBuffers = maxBuffers;
+}
+
+PooledBuffer BufferPool::Acquire(size_t size) {
+    std::unique_ptr<std::vector<std::uint8_t>> buffer;
+    {
+        std::unique_lock<std::mutex> lk(m_storage->mutex);
+        if (!m_storage->buffers.empty()) {
+            buffer = std::move(m_storage->buffers.back());
+            m_storage->buffers.pop_back();
+        }
+    }
+
+    if (!buffer)
+        buffer = std::make_unique<std::vector<std::uint8_t>>();
+
+    buffer->resize(size);
+
+    std::weak_ptr<Storage> weakStorage = m_storage;
+    return PooledBuffer(buffer.release(), [weakStorage](std::vector<std::uint8_t> *b) {
+        std::unique_ptr<std::vector<std::uint8_t>> owned(b);
+
+        auto storage = weakStorage.lock();
+        if (!storage)
+            return;
+
+        std::unique_lock<std::mutex> lk(storage->mutex);
+        if (storage->buffers.size() < storage->maxBuffers)
+            storage->buffers.push_back(std::move(owned));
+    });
+}
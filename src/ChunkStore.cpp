@@ -0,0 +1,222 @@
+#include "ChunkStore.h"
+
+#include <array>
+#include <fstream>
+#include <sstream>
+
+namespace {
+    /**
+     * Chunk size limits. Boundaries fall on average every 8 KiB past the minimum.
+     */
+    constexpr size_t minChunkSize{2 * 1024};
+    constexpr size_t maxChunkSize{64 * 1024};
+    constexpr std::uint64_t boundaryMask{0x1FFFull << 51};
+
+    /**
+     * Random values for the gear hash, generated with splitmix64 so they're the same on every build
+     */
+    const std::array<std::uint64_t, 256> gear = [] {
+        std::array<std::uint64_t, 256> table{};
+        std::uint64_t x{0};
+        for (auto &value : table) {
+            x += 0x9E3779B97F4A7C15ull;
+            std::uint64_t z = x;
+            z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+            z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+            value = z ^ (z >> 31);
+        }
+        return table;
+    }();
+
+    /**
+     * Gets the size of the chunk starting at data
+     */
+    size_t nextBoundary(const std::uint8_t *data, size_t size) {
+        if (size <= minChunkSize)
+            return size;
+
+        const size_t limit = std::min(size, maxChunkSize);
+        std::uint64_t hash{0};
+        for (size_t i = minChunkSize; i < limit; ++i) {
+            hash = (hash << 1) + gear[data[i]];
+            if (!(hash & boundaryMask))
+                return i + 1;
+        }
+
+        return limit;
+    }
+}
+
+ChunkStore::ChunkStore(const boost::filesystem::path &root) : m_root{root} {
+    boost::filesystem::create_directories(m_root);
+}
+
+boost::filesystem::path ChunkStore::ChunkPath(const std::string &id) const {
+    return m_root / id.substr(0, 2) / id;
+}
+
+bool ChunkStore::Put(const boost::filesystem::path &manifestPath, const std::uint8_t *data, size_t size) {
+    std::ostringstream manifest;
+    manifest << "LPMF 1\n" << "size " << size << '\n';
+
+    std::vector<std::string> ids;
+    std::vector<std::uint8_t> encoded;
+
+    std::unique_lock<std::mutex> lk(m_mutex);
+
+    for (size_t offset = 0; offset < size;) {
+        const auto length = nextBoundary(data + offset, size - offset);
+
+        MD5 md5;
+        md5.update(data + offset, static_cast<MD5::size_type>(length));
+        const auto id = md5.finalize().hexdigest();
+
+        const auto it = m_chunks.find(id);
+        if (it == m_chunks.end() || it->second.references == 0) {
+            const auto path = ChunkPath(id);
+            if (!boost::filesystem::exists(path)) {
+                boost::filesystem::create_directories(path.parent_path());
+                StateCodec::EncodeKeyframe(data + offset, length, encoded);
+                if (!StateCodec::WriteFile(path, encoded))
+                    return false;
+            }
+        }
+
+        ids.push_back(id);
+        manifest << id << ' ' << length << '\n';
+        offset += length;
+    }
+
+    const auto text = manifest.str();
+    if (!StateCodec::WriteFile(manifestPath, std::vector<std::uint8_t>(text.begin(), text.end())))
+        return false;
+
+    // Only counted once the manifest exists, chunks written before a failure are swept by the next Rebuild
+    for (const auto &id : ids) {
+        auto &chunk = m_chunks[id];
+        if (chunk.references++ == 0) {
+            boost::system::error_code err;
+            chunk.storedSize = boost::filesystem::file_size(ChunkPath(id), err);
+            if (!err)
+                m_storedBytes += chunk.storedSize;
+        }
+    }
+
+    return true;
+}
+
+bool ChunkStore::Get(const boost::filesystem::path &manifestPath, std::vector<std::uint8_t> &out) {
+    std::uint64_t size;
+    std::vector<std::pair<std::string, std::uint64_t>> chunks;
+    if (!ReadManifest(manifestPath, size, chunks))
+        return false;
+
+    out.clear();
+    out.reserve(size);
+
+    std::vector<std::uint8_t> encoded, chunk;
+    for (const auto &entry : chunks) {
+        if (!StateCodec::ReadFile(ChunkPath(entry.first), encoded) ||
+            !StateCodec::Decode(encoded.data(), encoded.size(), nullptr, chunk) || chunk.size() != entry.second)
+            return false;
+
+        out.insert(out.end(), chunk.begin(), chunk.end());
+    }
+
+    return out.size() == size;
+}
+
+void ChunkStore::Release(const std::string &id) {
+    auto it = m_chunks.find(id);
+    if (it == m_chunks.end())
+        return;
+
+    if (--it->second.references == 0) {
+        boost::system::error_code err;
+        boost::filesystem::remove(ChunkPath(id), err);
+        m_storedBytes -= it->second.storedSize;
+        m_chunks.erase(it);
+    }
+}
+
+void ChunkStore::Remove(const boost::filesystem::path &manifestPath) {
+    std::uint64_t size;
+    std::vector<std::pair<std::string, std::uint64_t>> chunks;
+    const bool valid = ReadManifest(manifestPath, size, chunks);
+
+    std::unique_lock<std::mutex> lk(m_mutex);
+
+    // Manifest goes first so that a crash can only leave unreferenced chunks behind, never a dangling manifest
+    boost::system::error_code err;
+    boost::filesystem::remove(manifestPath, err);
+
+    if (!valid)
+        return;
+
+    for (const auto &entry : chunks)
+        Release(entry.first);
+}
+
+void ChunkStore::Rebuild(const std::vector<boost::filesystem::path> &manifestDirectories) {
+    std::unique_lock<std::mutex> lk(m_mutex);
+    m_chunks.clear();
+    m_storedBytes = 0;
+
+    std::uint64_t size;
+    std::vector<std::pair<std::string, std::uint64_t>> chunks;
+    for (const auto &directory : manifestDirectories) {
+        if (!boost::filesystem::is_directory(directory))
+            continue;
+
+        for (auto &p : boost::filesystem::directory_iterator(directory)) {
+            if (p.path().extension() != ".manifest" || !ReadManifest(p.path(), size, chunks))
+                continue;
+
+            for (const auto &entry : chunks)
+                ++m_chunks[entry.first].references;
+        }
+    }
+
+    for (auto &p : boost::filesystem::recursive_directory_iterator(m_root)) {
+        if (!boost::filesystem::is_regular_file(p.path()))
+            continue;
+
+        auto it = m_chunks.find(p.path().filename().string());
+        if (it == m_chunks.end()) {
+            boost::system::error_code err;
+            boost::filesystem::remove(p.path(), err);
+            continue;
+        }
+
+        it->second.storedSize = boost::filesystem::file_size(p.path());
+        m_storedBytes += it->second.storedSize;
+    }
+}
+
+std::uint64_t ChunkStore::storedBytes() {
+    std::unique_lock<std::mutex> lk(m_mutex);
+    return m_storedBytes;
+}
+
+bool ChunkStore::ReadManifest(const boost::filesystem::path &manifestPath, std::uint64_t &size,
+                              std::vector<std::pair<std::string, std::uint64_t>> &chunks) {
+    std::ifstream fi(manifestPath.string());
+    std::string magic, version, sizeKey;
+
+    if (!(fi >> magic >> version >> sizeKey >> size) || magic != "LPMF" || version != "1" || sizeKey != "size")
+        return false;
+
+    chunks.clear();
+
+    std::string id;
+    std::uint64_t length, total{0};
+    while (fi >> id >> length) {
+        if (id.size() != 32)
+            return false;
+
+        chunks.emplace_back(id, length);
+        total += length;
+    }
+
+    return total == size;
+}
@@ -1,5 +1,60 @@
 #include "EmulatorController.h"
 
+#include <sstream>
+#include <streambuf>
+
+#include <websocketpp/config/core.hpp>
+#include <websocketpp/server.hpp>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/resource.h>
+#endif
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#endif
+
+namespace {
+    /**
+     * Stands in for a socket in the benchmark, only counting what's written to it
+     */
+    class CountingBuffer : public std::streambuf {
+        std::uint64_t m_count{0};
+
+      protected:
+        int_type overflow(int_type c) override {
+            if (!traits_type::eq_int_type(c, traits_type::eof()))
+                ++m_count;
+            return traits_type::not_eof(c);
+        }
+
+        std::streamsize xsputn(const char *, std::streamsize count) override {
+            m_count += static_cast<std::uint64_t>(count);
+            return count;
+        }
+
+      public:
+        std::uint64_t count() const {
+            return m_count;
+        }
+    };
+
+    using MockServer = websocketpp::server<websocketpp::config::core>;
+
+    /**
+     * Websocket connection on the iostream transport, so that sending to it goes through all of websocketpp's send
+     * path without a network
+     */
+    struct MockConnection {
+        CountingBuffer buffer;
+        std::ostream out{&buffer};
+        MockServer::connection_ptr connection;
+    };
+}
+
 /**
  * Now, you're probably wondering: static thread_local? namespaced pseudo-classes? Surely this guy is crazy!
  * Well, you're in for a story. Basically, the libretro API, the thing that this 'class' interacts with
@@ -22,12 +77,22 @@ namespace EmulatorController {
     static thread_local EmuID_t id;
 
     /**
-     * Name of the library that is loaded (mGBA, Snes9x, bsnes, etc).
-     *
-     * @todo Grab the info from the loaded core and populate this field.
+     * Name of the library that is loaded (mGBA, Snes9x, bsnes, etc). Used to look up the core's options in
+     * config["coreConfig"].
      */
     static thread_local std::string coreName;
 
+    /**
+     * Core option values handed out through RETRO_ENVIRONMENT_GET_VARIABLE. Stored so the pointers given to the core
+     * stay valid.
+     */
+    static thread_local std::map<std::string, std::string> coreVariables;
+
+    /**
+     * Whether or not the core said it can run without a game through RETRO_ENVIRONMENT_SET_SUPPORT_NO_GAME
+     */
+    static thread_local bool supportsNoGame{false};
+
     /**
      * Pointer to the server managing the emulator controller
      */
@@ -45,9 +110,14 @@ namespace EmulatorController {
     static thread_local RetroCore Core;
 
     /**
-     * Rom data if loaded from file.
+     * Rom data if loaded from file. Mapped, and shared with other emulators running the same rom.
+     */
+    static thread_local std::shared_ptr<RomImage> rom;
+
+    /**
+     * The rom, if it came out of an archive. Held so that its cache entry isn't evicted while the core is running.
      */
-    static thread_local char *romData{nullptr};
+    static thread_local std::shared_ptr<ExtractedRom> extractedRom;
 
     /**
      * Turn queue for this emulator
@@ -64,6 +134,11 @@ namespace EmulatorController {
      */
     static thread_local RetroPad joypad;
 
+    /**
+     * Updates for joypad, applied before every frame
+     */
+    static thread_local InputQueue inputQueue;
+
     /**
      * Stores the masks and shifts required to generate a rgb 0xRRGGBB
      * vector from the video_refresh callback data.
@@ -100,6 +175,21 @@ namespace EmulatorController {
      */
     static thread_local std::chrono::time_point <std::chrono::steady_clock> lastFastForward;
 
+    /**
+     * How many frames are run per tick while fast forwarding. Adapts to how long the batches take.
+     */
+    static thread_local unsigned fastForwardMultiplier{2};
+
+    /**
+     * Upper limit for fastForwardMultiplier, loaded from config.
+     */
+    static thread_local unsigned maxFastForwardMultiplier{2};
+
+    /**
+     * How long one frame is at the core's native framerate.
+     */
+    static thread_local std::chrono::microseconds frameTime{16'667};
+
     /**
      * Location of the emulator directory, loaded from config.
      */
@@ -115,11 +205,32 @@ namespace EmulatorController {
      */
     static thread_local std::string saveDirString;
 
+    /**
+     * Save directory of the run-ahead second instance, emptied every time it's loaded. Its saves are written from
+     * speculative frames, so they can't go where the real ones are.
+     */
+    static thread_local std::string runAheadSaveDirString;
+
     /**
      * General mutex for things that won't really go off at once and get blocked.
      */
     static thread_local std::shared_timed_mutex generalMutex;
 
+    /**
+     * Buffers that save states are serialized into before being handed to the IO worker
+     */
+    static thread_local BufferPool savePool;
+
+    /**
+     * Where history and backup states are stored. Shared with the IO worker jobs using it.
+     */
+    static thread_local std::shared_ptr<ChunkStore> chunkStore;
+
+    /**
+     * Entries in the history directory. Shared with the IO worker jobs using it.
+     */
+    static thread_local std::shared_ptr<HistoryIndex> historyIndex;
+
 
     /*
      * --- Work Queue Stuff ---
@@ -188,127 +299,167 @@ namespace EmulatorController {
       * If, for some reason, this value is exported via the EmulatorProxy, then it should be changed to an atomic.
       */
       static thread_local std::uint64_t users{0};
-}
 
+    /**
+     * Set while benchmarking, which runs ahead like there was someone watching even though there are no users
+     */
+    static thread_local bool benchmarking{false};
 
-void EmulatorController::Run(const std::string& corePath, const std::string& romPath,
-                             LetsPlayServer *t_server, EmuID_t t_id, const std::string &description) {
-    boost::filesystem::path coreFile = corePath, romFile = romPath;
-    if (!boost::filesystem::is_regular_file(coreFile)) {
-        t_server->logger.err("Provided core path '", corePath, "' was invalid.");
-        return;
-    }
+    /*
+     * --- Run-ahead ---
+     */
 
-    if (!romPath.empty() && !boost::filesystem::is_regular_file(romFile)) {
-        server->logger.err("Provided rom path '", romPath, "' was not valid.");
-        return;
-    }
+    /**
+     * How many frames to run ahead of the real frame. 0 if run-ahead is disabled.
+     */
+    static thread_local unsigned runAheadFrames{0};
 
+    /**
+     * Whether or not the speculative frames are run on runAheadCore instead of rolling back Core
+     */
+    static thread_local bool runAheadSecondInstance{false};
 
-    // Create emu folder if it doesn't already exist
-    t_server->logger.log("Creating emulator directories...");
-    boost::filesystem::create_directories(dataDirectory = t_server->emuDirectory / t_id);
-    boost::filesystem::create_directories(dataDirectory / "history");
-    boost::filesystem::create_directories(dataDirectory / "backups" / "states");
-    boost::filesystem::create_directories(saveDirectory = dataDirectory / "saves");
+    /**
+     * Second copy of the core used for the speculative frames in second instance mode.
+     */
+    static thread_local RetroCore runAheadCore;
 
-    t_server->logger.log("Copying core file to own path... (", (dataDirectory / "emulator.so").string(), ')');
-    boost::filesystem::remove((dataDirectory / "emulator.so").string());
-    boost::filesystem::copy_file(coreFile.string(), (dataDirectory / "emulator.so").string());
+    /**
+     * Reused buffer the state is serialized into before running ahead
+     */
+    static thread_local std::vector<std::uint8_t> runAheadState;
 
-    t_server->logger.log("Starting up ", t_id, "...");
+    /**
+     * Size of the state currently in runAheadState
+     */
+    static thread_local size_t runAheadStateSize{0};
 
-    Core.Load((dataDirectory / "emulator.so").string().c_str());
+    /**
+     * Whether or not Core has run ahead and needs to be restored by RestoreRunAhead
+     */
+    static thread_local bool runAheadPending{false};
 
-    server = t_server;
-    id = t_id;
-    proxy = EmulatorControllerProxy{&workQueue, &queueMutex, &queueNotifier, GetFrame, &joypad, description, &forbiddenCombos};
+    /**
+     * Set while running frames that shouldn't be shown. OnVideoRefresh ignores frames while this is set.
+     */
+    static thread_local bool suppressVideo{false};
 
-    server->AddEmu(id, &proxy);
+    /**
+     * Total time spent running ahead (hidden frames, serialization and restoring) since the last report
+     */
+    static thread_local std::chrono::nanoseconds runAheadTime{0};
 
-    // Add emu specific config if it doesn't already exist
-    auto emuConfigs = server->config.get<nlohmann::json>(nlohmann::json::value_t::object, "serverConfig", "emulators");
-    if(!emuConfigs.count(id)) {
-        auto emuTemplate = server->config.get<nlohmann::json>(nlohmann::json::value_t::object, "serverConfig", "emulators", "template");
-        server->config.set("serverConfig", "emulators", id, emuTemplate);
-    }
+    /**
+     * How many frames were run ahead since the last report
+     */
+    static thread_local std::uint64_t runAheadRuns{0};
 
-    server->config.SaveConfig();
+    /*
+     * --- Input latency ---
+     */
 
-    Core.SetEnvironment(OnEnvironment);
-    Core.SetVideoRefresh(OnVideoRefresh);
-    Core.SetInputPoll(OnPollInput);
-    Core.SetInputState(OnGetInputState);
-    Core.SetAudioSample(OnLRAudioSample);
-    Core.SetAudioSampleBatch(OnBatchAudioSample);
-    Core.Init();
+    /**
+     * Total time from input being received to the core reading it, since the last report
+     */
+    static thread_local std::chrono::nanoseconds inputLatencyTotal{0};
 
-    // Load forbidden button combos into memory
-    auto jForbiddenCombos = server->config.get<nlohmann::json>(nlohmann::json::value_t::array, "serverConfig", "emulators", id, "forbiddenCombos");
+    /**
+     * Longest time from input being received to the core reading it, since the last report
+     */
+    static thread_local std::chrono::nanoseconds inputLatencyMax{0};
 
-    for(std::string buttons : jForbiddenCombos) {
-        bool goodCombo{true};
-        std::stringstream ss{buttons};
-        std::bitset<16> combo;
-        for(std::string button; ss >> button;) {
-            std::transform(button.begin(), button.end(), button.begin(), ::tolower);
-            try {
-                const auto retroID = buttonAsRetroID.at(button);
-                combo[retroID] = true;
-            } catch(const std::out_of_range& e) {
-                server->logger.log(id, ": Invalid button name found in forbiddenCombos list called '", button, "'.");
-                goodCombo = false;
-                break;
-            }
-        }
-        if(combo.any() && goodCombo)
-            forbiddenCombos.push_back(combo);
-    }
+    /**
+     * How many input updates were read since the last report
+     */
+    static thread_local std::uint64_t inputLatencySamples{0};
 
-    server->logger.log(id, ": Finished initialization.");
+    /*
+     * --- Input movies ---
+     */
 
-    // If provided an empty path, just skip this part. Leaving a blank path allows for cores that don't need roms to be loaded
-    if(!romPath.empty()) {
-        retro_game_info info = {romPath.c_str(), nullptr, static_cast<size_t>(boost::filesystem::file_size(romFile)),
-                                nullptr};
-        std::ifstream fo(romFile.string(), std::ios::binary);
+    /**
+     * How many real (not run ahead) frames have been run since the movie being recorded or replayed started
+     */
+    static thread_local std::uint64_t frameCount{0};
 
-        retro_system_info system{};
-        Core.GetSystemInfo(&system);
+    /**
+     * Records joypad changes if recordInput is enabled
+     */
+    static thread_local InputRecorder recorder;
 
-        if (!system.need_fullpath) {
-            romData = new char[boost::filesystem::file_size(romFile)];
-            info.data = static_cast<void *>(romData);
+    /**
+     * Movie being replayed, if any
+     */
+    static thread_local InputReplay replay;
 
-            if (!info.data) {
-                server->logger.err(id, ": Failed to allocate memory for the ROM");
-                return;
-            }
+    /**
+     * Pad the replay is applied to. Read by OnGetInputState instead of joypad while replaying.
+     */
+    static thread_local RetroPad replayPad;
 
-            if (!fo.read(romData, boost::filesystem::file_size(romFile))) {
-                server->logger.err(id, ": Failed to load data from the file. Do you have the correct access rights?");
-                return;
-            }
-        }
+    /**
+     * Whether or not a movie is being replayed
+     */
+    static thread_local bool replaying{false};
 
-        // TODO: compressed roms and stuff
+    /*
+     * --- Rewinding ---
+     */
 
-        if (!Core.LoadGame(&info)) {
-            server->logger.err(id, ": Failed to load game. Was the rom the correct file type?");
-            return;
-        }
-    }
+    /**
+     * Recent states, for admins undoing things
+     */
+    static thread_local RewindBuffer rewindBuffer;
 
-    // Load state if applicable
-    Load();
+    /**
+     * How many frames apart states are added to rewindBuffer
+     */
+    static thread_local std::uint64_t rewindInterval{60};
 
-    auto &config = server->config;
+    /**
+     * Frames run since the last state was added to rewindBuffer
+     */
+    static thread_local std::uint64_t framesSinceRewindCapture{0};
+
+    /**
+     * Buffer states are serialized into for rewindBuffer
+     */
+    static thread_local std::vector<std::uint8_t> rewindState;
+
+    /*
+     * --- Fork snapshots ---
+     */
+
+    /**
+     * Whether or not saves are serialized in a forked child
+     */
+    static thread_local bool forkSnapshots{false};
+
+    /**
+     * Longest a forked child gets to serialize before it's killed
+     */
+    static thread_local std::chrono::milliseconds forkTimeout;
+
+    /**
+     * Set by the IO worker when a forked save hangs or fails, which switches this emulator back to normal saves
+     */
+    static thread_local std::shared_ptr<std::atomic<bool>> forkFailed;
+}
 
-    Core.GetAudioVideoInfo(&avinfo);
+
+void EmulatorController::Run(const std::string& corePath, const std::string& romPath,
+                             LetsPlayServer *t_server, EmuID_t t_id, const std::string &description) {
+    if (!Init(corePath, romPath, t_server, t_id, description))
+        return;
+
+    auto &config = server->config;
 
     unsigned msWait = (1.0 / avinfo.timing.fps) * 1000;
     std::chrono::time_point<std::chrono::steady_clock> nextRun =
-            std::chrono::steady_clock::now() + std::chrono::milliseconds(msWait / (fastForward ? 2 : 1));
+            std::chrono::steady_clock::now() + std::chrono::milliseconds(msWait);
+
+    maxFastForwardMultiplier = std::max<std::uint64_t>(
+            config.getEmu<std::uint64_t>(nlohmann::json::value_t::number_unsigned, id, "fastForward", "maxMultiplier"), 1);
 
     // Set FPS if applicable
     auto overrideFPS = server->config.get<bool>(nlohmann::json::value_t::boolean, "serverConfig", "emulators", id,
@@ -323,7 +474,8 @@ void EmulatorController::Run(const std::string& corePath, const std::string& rom
 
     // Terrible main emulator loop that manages all the things
     std::chrono::time_point<std::chrono::steady_clock> turnEnd, nextFrame;
-    bool frameSkip = false;
+    auto nextRunAheadReport = std::chrono::steady_clock::now() + std::chrono::seconds(30);
+    auto nextInputLatencyReport = std::chrono::steady_clock::now() + std::chrono::seconds(30);
     while (true) {
         // Check turn state
         // Possible race condition but wouldn't really matter because it'd be a read during a write onto a boolean value
@@ -349,6 +501,7 @@ void EmulatorController::Run(const std::string& corePath, const std::string& rom
                             currentUser->hasTurn = false;
                             currentUser->requestedTurn = false;
                             turnQueue.erase(turnQueue.begin());
+                            inputQueue.Clear();
                             joypad.resetValues();
                             EmulatorController::SendTurnList();
                         }
@@ -358,6 +511,7 @@ void EmulatorController::Run(const std::string& corePath, const std::string& rom
                 std::unique_lock <std::mutex> lk(turnMutex);
                 if (!turnQueue.empty()) {
                     turnQueue.erase(turnQueue.begin());
+                    inputQueue.Clear();
                     joypad.resetValues();
                     EmulatorController::SendTurnList();
                 }
@@ -365,59 +519,300 @@ void EmulatorController::Run(const std::string& corePath, const std::string& rom
         }
 
         // While there's work and we have time before the next retro_run call
-        while (!workQueue.empty() && (std::chrono::steady_clock::now() < nextRun) &&
+        while ((std::chrono::steady_clock::now() < nextRun) &&
                (!overrideFPS || (std::chrono::steady_clock::now() < nextFrame))) {
-            auto &command = workQueue.front();
+            // Taken off under the lock since network threads push onto the queue at the same time
+            EmuCommand command;
+            {
+                std::unique_lock <std::mutex> lk(queueMutex);
+                if (workQueue.empty())
+                    break;
+
+                command = std::move(workQueue.front());
+                workQueue.pop();
+            }
+
+            switch (command.command) {
+                case kEmuCommandType::Save:
+                    Save();
+                    break;
+                case kEmuCommandType::Backup:
+                    Backup();
+                    break;
+                case kEmuCommandType::GeneratePreview:
+                    server->GeneratePreview(id);
+                    break;
+                case kEmuCommandType::TurnRequest:
+                    if (command.user_hdl)
+                        AddTurnRequest(*command.user_hdl);
+                    break;
+                case kEmuCommandType::UserDisconnect:
+                    if(users)
+                        --users;
+                    if (command.user_hdl)
+                        UserDisconnected(*command.user_hdl);
+                    break;
+                case kEmuCommandType::FastForward:
+                    FastForward();
+                    break;
+                case kEmuCommandType::Rewind:
+                    Rewind(command.value);
+                    break;
+                case kEmuCommandType::UserConnect:
+                    ++users;
+                    EmulatorController::SendTurnList();
+                    break;
+            }
+        }
+
+        // Wait until the next frame because at this point we've either passed the wait time (so 0 wait) or have no more work
+        // NOTE: If on a slow fps rate, there will be a lot of wasted time and the turns updating and work queue will be slow
+        // This relies on the fact that emulators usually want to be run 30 to 60 times a second
+        std::this_thread::sleep_until(nextRun);
+        nextRun = std::chrono::steady_clock::now() + std::chrono::milliseconds(msWait);
+
+        if (fastForward)
+            RunFastForward();
+        else
+            RunFrame();
+
+        if(users) {
+            if (overrideFPS && (nextFrame < std::chrono::steady_clock::now())) {
+                server->SendFrame(id);
+                nextFrame = std::chrono::steady_clock::now() + frameDeltaTime;
+            } else if (!overrideFPS) {
+                server->SendFrame(id);
+            }
+        }
+
+        // Roll back after the frame is sent so that the video buffer isn't touched before it's encoded
+        RestoreRunAhead();
+
+        // Report the run-ahead cost so that the amount of frames can be tuned
+        if (runAheadRuns && nextRunAheadReport < std::chrono::steady_clock::now()) {
+            const auto averageCost = std::chrono::duration_cast<std::chrono::microseconds>(runAheadTime).count() /
+                                     static_cast<std::int64_t>(runAheadRuns);
+            server->logger.log(id, ": Running ", runAheadFrames, " frame(s) ahead costs ", averageCost,
+                               "us per frame (frame budget is ", msWait * 1000, "us).");
+
+            runAheadTime = std::chrono::nanoseconds(0);
+            runAheadRuns = 0;
+            nextRunAheadReport = std::chrono::steady_clock::now() + std::chrono::seconds(30);
+        }
+
+        // Report how long input takes to reach the core, which should stay under a frame
+        if (nextInputLatencyReport < std::chrono::steady_clock::now()) {
+            using std::chrono::microseconds;
+            const auto coalesced = inputQueue.TakeCoalesced(), dropped = inputQueue.TakeDropped();
+            if (inputLatencySamples) {
+                const auto average = std::chrono::duration_cast<microseconds>(inputLatencyTotal).count() /
+                                     static_cast<std::int64_t>(inputLatencySamples);
+                server->logger.log(id, ": Input reached the core ", average, "us after being received on average (max ",
+                                   std::chrono::duration_cast<microseconds>(inputLatencyMax).count(), "us, ",
+                                   inputLatencySamples, " updates, ", coalesced, " coalesced, ", dropped,
+                                   " dropped, frame budget is ", msWait * 1000, "us).");
+            } else if (dropped) {
+                server->logger.log(id, ": Warning; Dropped ", dropped, " input updates because the queue was full.");
+            }
+
+            inputLatencyTotal = inputLatencyMax = std::chrono::nanoseconds(0);
+            inputLatencySamples = 0;
+            nextInputLatencyReport = std::chrono::steady_clock::now() + std::chrono::seconds(30);
+        }
+    }
+}
+
+bool EmulatorController::Init(const std::string& corePath, const std::string& romPath,
+                              LetsPlayServer *t_server, EmuID_t t_id, const std::string &description) {
+    boost::filesystem::path coreFile = corePath, romFile = romPath;
+    if (!boost::filesystem::is_regular_file(coreFile)) {
+        t_server->logger.err("Provided core path '", corePath, "' was invalid.");
+        return false;
+    }
+
+    if (!romPath.empty() && !boost::filesystem::is_regular_file(romFile)) {
+        t_server->logger.err("Provided rom path '", romPath, "' was not valid.");
+        return false;
+    }
+
+
+    // Create emu folder if it doesn't already exist
+    t_server->logger.log("Creating emulator directories...");
+    boost::filesystem::create_directories(dataDirectory = t_server->emuDirectory / t_id);
+    boost::filesystem::create_directories(dataDirectory / "history");
+    boost::filesystem::create_directories(dataDirectory / "backups" / "states");
+    boost::filesystem::create_directories(saveDirectory = dataDirectory / "saves");
+
+    chunkStore = std::make_shared<ChunkStore>(dataDirectory / "store");
+
+    // The only time the history directory is scanned, saves keep the index up to date after this
+    historyIndex = std::make_shared<HistoryIndex>();
+    historyIndex->Load(dataDirectory / "history");
+
+    t_server->logger.log("Copying core file to own path... (", (dataDirectory / "emulator.so").string(), ')');
+    boost::filesystem::remove((dataDirectory / "emulator.so").string());
+    boost::filesystem::copy_file(coreFile.string(), (dataDirectory / "emulator.so").string());
+
+    t_server->logger.log("Starting up ", t_id, "...");
+
+    Core.Load((dataDirectory / "emulator.so").string().c_str());
+
+    {
+        retro_system_info system{};
+        Core.GetSystemInfo(&system);
+        if (system.library_name)
+            coreName = system.library_name;
+    }
+
+    server = t_server;
+    id = t_id;
+    proxy = EmulatorControllerProxy{&workQueue, &queueMutex, &queueNotifier, GetFrame, &joypad, description, &forbiddenCombos, &inputQueue};
+
+    server->AddEmu(id, &proxy);
+
+    // Reference counts aren't saved, so count them from the manifests before anything else uses the store
+    {
+        auto store = chunkStore;
+        const std::vector<boost::filesystem::path> manifestDirectories{dataDirectory / "history",
+                                                                       dataDirectory / "backups" / "states"};
+        server->ioWorker.Queue([store, manifestDirectories]() { store->Rebuild(manifestDirectories); }, id);
+    }
+
+    // Add emu specific config if it doesn't already exist
+    auto emuConfigs = server->config.get<nlohmann::json>(nlohmann::json::value_t::object, "serverConfig", "emulators");
+    if(!emuConfigs.count(id)) {
+        auto emuTemplate = server->config.get<nlohmann::json>(nlohmann::json::value_t::object, "serverConfig", "emulators", "template");
+        server->config.set("serverConfig", "emulators", id, emuTemplate);
+    }
+
+    server->config.SaveConfig();
+
+    Core.SetEnvironment(OnEnvironment);
+    Core.SetVideoRefresh(OnVideoRefresh);
+    Core.SetInputPoll(OnPollInput);
+    Core.SetInputState(OnGetInputState);
+    Core.SetAudioSample(OnLRAudioSample);
+    Core.SetAudioSampleBatch(OnBatchAudioSample);
+    Core.Init();
+
+    // Load forbidden button combos into memory
+    auto jForbiddenCombos = server->config.get<nlohmann::json>(nlohmann::json::value_t::array, "serverConfig", "emulators", id, "forbiddenCombos");
+
+    for(std::string buttons : jForbiddenCombos) {
+        bool goodCombo{true};
+        std::stringstream ss{buttons};
+        std::bitset<16> combo;
+        for(std::string button; ss >> button;) {
+            std::transform(button.begin(), button.end(), button.begin(), ::tolower);
+            try {
+                const auto retroID = buttonAsRetroID.at(button);
+                combo[retroID] = true;
+            } catch(const std::out_of_range& e) {
+                server->logger.log(id, ": Invalid button name found in forbiddenCombos list called '", button, "'.");
+                goodCombo = false;
+                break;
+            }
+        }
+        if(combo.any() && goodCombo)
+            forbiddenCombos.push_back(combo);
+    }
+
+    server->logger.log(id, ": Finished initialization.");
+
+    // Path the core is given, which is the extracted file for roms in archives
+    std::string gamePath = romPath;
+    retro_game_info info = {gamePath.c_str(), nullptr, 0, nullptr};
+
+    // If provided an empty path, just skip this part. Leaving a blank path allows for cores that don't need roms to be loaded
+    if(!romPath.empty()) {
+        retro_system_info system{};
+        Core.GetSystemInfo(&system);
 
-            switch (command.command) {
-                case kEmuCommandType::Save:
-                    Save();
-                    break;
-                case kEmuCommandType::Backup:
-                    Backup();
-                    break;
-                case kEmuCommandType::GeneratePreview:
-                    server->GeneratePreview(id);
-                    break;
-                case kEmuCommandType::TurnRequest:
-                    if (command.user_hdl)
-                        AddTurnRequest(*command.user_hdl);
-                    break;
-                case kEmuCommandType::UserDisconnect:
-                    if(users)
-                        --users;
-                    if (command.user_hdl)
-                        UserDisconnected(*command.user_hdl);
-                    break;
-                case kEmuCommandType::FastForward:
-                    FastForward();
-                    break;
-                case kEmuCommandType::UserConnect:
-                    ++users;
-                    EmulatorController::SendTurnList();
-                    break;
+        // Cores that can open archives themselves set block_extract
+        auto extension = romFile.extension().string();
+        std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+        if (extension == ".zip" && !system.block_extract) {
+            server->logger.log(id, ": Getting the rom out of ", romFile.filename().string(), "...");
+
+            const auto maxCacheBytes = static_cast<std::uintmax_t>(
+                    server->config.get<std::uint64_t>(nlohmann::json::value_t::number_unsigned, "serverConfig",
+                                                      "romCacheMB")) << 20;
+
+            std::string error;
+            extractedRom = server->romCache.Extract(romFile, server->cacheDirectory / "roms", maxCacheBytes,
+                                                    system.valid_extensions ? system.valid_extensions : "", error);
+            if (!extractedRom) {
+                server->logger.err(id, ": ", error);
+                return false;
             }
-            std::unique_lock <std::mutex> lk(queueMutex);
-            workQueue.pop();
+
+            romFile = extractedRom->path();
+
+            gamePath = romFile.string();
+            info.path = gamePath.c_str();
         }
 
-        // Wait until the next frame because at this point we've either passed the wait time (so 0 wait) or have no more work
-        // NOTE: If on a slow fps rate, there will be a lot of wasted time and the turns updating and work queue will be slow
-        // This relies on the fact that emulators usually want to be run 30 to 60 times a second
-        std::this_thread::sleep_until(nextRun);
-        nextRun = std::chrono::steady_clock::now() + std::chrono::milliseconds(msWait / (fastForward ? 2 : 1));
-        Core.Run();
+        info.size = static_cast<size_t>(boost::filesystem::file_size(romFile));
 
-        if(users) {
-            if (overrideFPS && (nextFrame < std::chrono::steady_clock::now())) {
-                server->SendFrame(id);
-                nextFrame = std::chrono::steady_clock::now() + frameDeltaTime;
-            } else if (!overrideFPS) {
-                if (fastForward && (frameSkip ^= true)) server->SendFrame(id);
-                else server->SendFrame(id);
+        if (!system.need_fullpath) {
+            // Cores aren't supposed to write to the rom, but for ones that do it can be a private copy-on-write map
+            const bool copyOnWrite = server->config.getEmu<bool>(nlohmann::json::value_t::boolean, id,
+                                                                 "romCopyOnWrite");
+            rom = server->romCache.Open(romFile, copyOnWrite);
+
+            if (!rom) {
+                server->logger.err(id, ": Failed to map the ROM. Do you have the correct access rights?");
+                return false;
             }
+
+            info.data = rom->data();
+            info.size = rom->size();
+        }
+
+        if (!Core.LoadGame(&info)) {
+            server->logger.err(id, ": Failed to load game. Was the rom the correct file type?");
+            return false;
         }
+    } else if (supportsNoGame && !Core.LoadGame(nullptr)) {
+        server->logger.err(id, ": Core failed to start without a game.");
+        return false;
+    }
+
+    // Load state if applicable
+    Load();
+
+    auto &config = server->config;
+
+    // Set up run-ahead if enabled
+    runAheadFrames = std::min<std::uint64_t>(
+            config.getEmu<std::uint64_t>(nlohmann::json::value_t::number_unsigned, id, "runAhead", "frames"), 6);
+
+    if (runAheadFrames) {
+        if (config.getEmu<bool>(nlohmann::json::value_t::boolean, id, "runAhead", "secondInstance"))
+            runAheadSecondInstance = LoadRunAheadInstance(romPath.empty() ? nullptr : &info);
+
+        server->logger.log(id, ": Running ", runAheadFrames, " frame(s) ahead",
+                           runAheadSecondInstance ? " using a second instance." : ".");
     }
+
+    Core.GetAudioVideoInfo(&avinfo);
+    frameTime = std::chrono::microseconds(static_cast<std::int64_t>(1'000'000 / avinfo.timing.fps));
+
+    if (config.getEmu<bool>(nlohmann::json::value_t::boolean, id, "recordInput"))
+        StartRecording();
+
+    rewindInterval = config.getEmu<std::uint64_t>(nlohmann::json::value_t::number_unsigned, id, "rewind", "interval");
+    const auto rewindMemory = config.getEmu<std::uint64_t>(nlohmann::json::value_t::number_unsigned, id, "rewind",
+                                                           "memoryMB");
+    rewindBuffer.Reset(rewindInterval ? rewindMemory * 1024 * 1024 : 0);
+    framesSinceRewindCapture = 0;
+
+    forkSnapshots = config.getEmu<bool>(nlohmann::json::value_t::boolean, id, "forkSnapshots", "enabled");
+    forkTimeout = std::chrono::milliseconds(
+            config.getEmu<std::uint64_t>(nlohmann::json::value_t::number_unsigned, id, "forkSnapshots", "timeout"));
+    forkFailed = std::make_shared<std::atomic<bool>>(false);
+
+    return true;
 }
 
 bool EmulatorController::OnEnvironment(unsigned cmd, void *data) {
@@ -440,6 +835,26 @@ bool EmulatorController::OnEnvironment(unsigned cmd, void *data) {
         case RETRO_ENVIRONMENT_GET_USERNAME:
             *static_cast<const char **>(data) = id.c_str();
             break;
+        case RETRO_ENVIRONMENT_SET_SUPPORT_NO_GAME:
+            supportsNoGame = *static_cast<const bool *>(data);
+            break;
+        case RETRO_ENVIRONMENT_GET_VARIABLE: { // core options = config["coreConfig"][library name]
+            auto *variable = static_cast<retro_variable *>(data);
+            variable->value = nullptr;
+
+            if (!variable->key || coreName.empty())
+                return false;
+
+            const auto options = config.get<nlohmann::json>(nlohmann::json::value_t::object, "coreConfig", coreName);
+            if (!options.is_object() || !options.count(variable->key))
+                return false;
+
+            const auto &option = options[variable->key];
+            auto &value = coreVariables[variable->key];
+            value = option.is_string() ? option.get<std::string>() : option.dump();
+            variable->value = value.c_str();
+            break;
+        }
         case RETRO_ENVIRONMENT_GET_OVERSCAN: // We don't (usually) want overscan
             return false;
             // Will be implemented
@@ -460,8 +875,20 @@ bool EmulatorController::OnEnvironment(unsigned cmd, void *data) {
     return true;
 }
 
+bool EmulatorController::OnRunAheadEnvironment(unsigned cmd, void *data) {
+    if (cmd == RETRO_ENVIRONMENT_GET_SAVE_DIRECTORY) {
+        *static_cast<const char **>(data) = runAheadSaveDirString.c_str();
+        return true;
+    }
+
+    return OnEnvironment(cmd, data);
+}
+
 void EmulatorController::OnVideoRefresh(const void *data, unsigned width, unsigned height,
                                         size_t pitch) {
+    if (suppressVideo)
+        return;
+
     std::unique_lock <std::mutex> lk(videoMutex);
     if (width != videoFormat.width || height != videoFormat.height ||
         pitch != videoFormat.pitch) {
@@ -485,11 +912,21 @@ std::int16_t EmulatorController::OnGetInputState(unsigned port, unsigned device,
     if (port != 0)
         return 0;
 
+    auto &pad = replaying ? replayPad : joypad;
+
+    std::chrono::steady_clock::time_point received;
+    if (!replaying && joypad.takeUpdate(received)) {
+        const auto latency = std::chrono::steady_clock::now() - received;
+        inputLatencyTotal += latency;
+        inputLatencyMax = std::max<std::chrono::nanoseconds>(inputLatencyMax, latency);
+        ++inputLatencySamples;
+    }
+
     switch (device) {
         case RETRO_DEVICE_JOYPAD:
-            return joypad.isPressed(id);
+            return pad.isPressed(id);
         case RETRO_DEVICE_ANALOG:
-            return joypad.analogValue(index, id);
+            return pad.analogValue(index, id);
         default:
             return 0;
     }
@@ -511,19 +948,22 @@ void EmulatorController::AddTurnRequest(LetsPlayUserHdl user_hdl) {
 }
 
 void EmulatorController::SendTurnList() {
-    const std::string turnList = [&] {
+    // Reused between calls, since the list is sent every time the turn changes
+    static thread_local std::vector<std::string> names;
+    static thread_local std::string turnList;
+    {
         // Majority of the time this won't lock because turnMutex will have already been locked by the caller
         std::unique_lock <std::mutex> lk(turnMutex, std::try_to_lock);
 
-        std::vector<std::string> names{"turns"};
+        names.assign(1, "turns");
         for (auto user_hdl : turnQueue) {
             // If pointer hasn't been deleted and user is still connected
             auto user = user_hdl.lock();
             if (user && user->connected)
                 names.push_back(user->username());
         }
-        return LetsPlayProtocol::encode(names);
-    }();
+        LetsPlayProtocol::encodeInto(turnList, names);
+    }
 
     server->BroadcastToEmu(id, turnList, websocketpp::frame::opcode::text);
 }
@@ -756,64 +1196,152 @@ Frame EmulatorController::GetFrame() {
 }
 
 void EmulatorController::Save() {
-    std::unique_lock <std::shared_timed_mutex> lk(generalMutex);
-    auto size = Core.SaveStateSize();
+    auto t_server = server;
+    auto t_id = id;
+    auto t_dataDirectory = dataDirectory;
+    auto store = chunkStore;
+    auto index = historyIndex;
+
+    // The emulator thread only waits for the fork, the child serializes from its copy of memory
+    if (forkSnapshots && !*forkFailed) {
+        std::shared_ptr<ForkSnapshot> snapshot;
+        {
+            std::unique_lock<std::shared_timed_mutex> lk(generalMutex);
+            auto size = Core.SaveStateSize();
+
+            if (size == 0) { // Not supported by the loaded core
+                server->logger.log(id, ": Warning; Saving for this core unsupported. Skipping save procedure.");
+                return;
+            }
 
-    if (size == 0) { // Not supported by the loaded core
-        server->logger.log(id, ": Warning; Saving for this core unsupported. Skipping save procedure.");
-        return;
-    }
+            snapshot = ForkSnapshot::Start(size, [](void *data, size_t length) { return Core.SaveState(data, length); });
+        }
 
-    std::vector<unsigned char> saveData(size);
+        if (snapshot) {
+            auto t_forkTimeout = forkTimeout;
+            auto t_forkFailed = forkFailed;
+            server->ioWorker.Queue([t_server, t_id, t_dataDirectory, store, index, snapshot, t_forkTimeout,
+                                    t_forkFailed]() {
+                bool timedOut;
+                if (!snapshot->Wait(t_forkTimeout, timedOut)) {
+                    t_server->logger.err(t_id, ": Forked save ", timedOut ? "timed out" : "failed",
+                                         ", so it was skipped. Saving on the emulator thread from now on.");
+                    *t_forkFailed = true;
+                    return;
+                }
 
-    if (!Core.SaveState(saveData.data(), size)) {
-        server->logger.log(id, ": Warning; Failed to serialize data with size ", size, ".");
-        return;
+                WriteState(t_server, t_id, t_dataDirectory, *store, *index, snapshot->data(), snapshot->size());
+            }, id, snapshot->size());
+            return;
+        }
+
+        server->logger.log(id, ": Warning; Couldn't fork to save, saving on the emulator thread instead.");
     }
 
-    auto newSaveFile = dataDirectory / "history" / "current.state";
+    PooledBuffer state;
+    {
+        std::unique_lock<std::shared_timed_mutex> lk(generalMutex);
+        auto size = Core.SaveStateSize();
+
+        if (size == 0) { // Not supported by the loaded core
+            server->logger.log(id, ": Warning; Saving for this core unsupported. Skipping save procedure.");
+            return;
+        }
 
-    if (boost::filesystem::exists(newSaveFile)) { // Move current file to a backup if if exists
-        server->logger.log(id, ": Existing state detected; Moving to new state.");
-        namespace chrono = std::chrono;
+        state = savePool.Acquire(size);
 
-        auto tp = chrono::system_clock::now().time_since_epoch();
-        auto timestamp = std::to_string(chrono::duration_cast<chrono::seconds>(tp).count());
+        if (!Core.SaveState(state->data(), size)) {
+            server->logger.log(id, ": Warning; Failed to serialize data with size ", size, ".");
+            return;
+        }
+    }
 
-        auto backupName = dataDirectory / "history" / (timestamp + ".state");
+    // Everything past serializing is done on the IO worker so the emulator doesn't stall on the disk
+    server->ioWorker.Queue([t_server, t_id, t_dataDirectory, store, index, state]() {
+        WriteState(t_server, t_id, t_dataDirectory, *store, *index, state->data(), state->size());
+    }, id, state->size());
+}
 
-        server->logger.log(id, ": Moved current state to ", backupName.string());
+void EmulatorController::WriteState(LetsPlayServer *t_server, const EmuID_t &t_id,
+                                    const boost::filesystem::path &t_dataDirectory, ChunkStore &store,
+                                    HistoryIndex &index, const std::uint8_t *state, size_t size) {
+    const auto historyDirectory = t_dataDirectory / "history";
+    const auto newSaveFile = historyDirectory / "current.state";
+    const auto tempSaveFile = historyDirectory / "current.state.tmp";
 
-        boost::filesystem::rename(newSaveFile, backupName);
-    }
+    // The current state is always a keyframe so that loading it never needs another file
+    std::vector<std::uint8_t> encoded;
+    StateCodec::EncodeKeyframe(state, size, encoded);
 
-    // Remove old temporaries
+    // Write to a temporary first so that a crash mid-write doesn't leave a truncated current state
     {
-        std::vector<boost::filesystem::path> temporaryStates;
-        for (auto &p : boost::filesystem::directory_iterator(dataDirectory / "history")) {
-            auto &path = p.path();
-
-            if (boost::filesystem::is_regular_file(path) && path.extension() == ".state" && path.filename() != "current")
-                temporaryStates.push_back(path);
+        std::ofstream fo(tempSaveFile.string(), std::ios::binary | std::ios::trunc);
+        fo.write(reinterpret_cast<const char *>(encoded.data()), encoded.size());
+        fo.close();
+
+        if (!fo) {
+            t_server->logger.err(t_id, ": Failed to write ", tempSaveFile.string(), ".");
+            boost::system::error_code err;
+            boost::filesystem::remove(tempSaveFile, err);
+            return;
         }
+    }
 
-        auto maxHistorySize = server->config.get<std::uint64_t>(nlohmann::json::value_t::number_unsigned,
-                                                                "serverConfig", "backups", "maxHistorySize");
-        if (temporaryStates.size() > maxHistorySize) {
-            // Sort by filename
-            std::sort(temporaryStates.begin(), temporaryStates.end(), [](const auto &a, const auto &b) {
-                return a.string() < b.string();
-            });
-
-            // Delete the oldest file
-            server->logger.log(id, ": Over threshold; Removing ", temporaryStates.front().string());
-            boost::filesystem::remove(temporaryStates.front());
+    namespace chrono = std::chrono;
+    const auto now = chrono::system_clock::to_time_t(chrono::system_clock::now());
+
+    if (boost::filesystem::exists(newSaveFile)) { // Move current file to a backup if if exists
+        auto timestamp = std::to_string(now);
+
+        // History entries go in the chunk store, where they share whatever chunks didn't change between saves
+        std::vector<std::uint8_t> previousEncoded, previous;
+        if (StateCodec::ReadFile(newSaveFile, previousEncoded) &&
+            StateCodec::Decode(previousEncoded.data(), previousEncoded.size(), nullptr, previous)) {
+            auto backupName = historyDirectory / (timestamp + ".manifest");
+
+            if (store.Put(backupName, previous.data(), previous.size())) {
+                t_server->logger.log(t_id, ": Moved current state to ", backupName.string());
+                index.Add(HistoryEntry{backupName, now, previous.size()});
+            } else {
+                t_server->logger.err(t_id, ": Failed to write ", backupName.string(), ".");
+            }
+        } else { // Can't be decoded, so keep it as it is rather than lose it
+            auto backupName = historyDirectory / (timestamp + ".state");
+            t_server->logger.log(t_id, ": Moved undecodable current state to ", backupName.string());
+            boost::filesystem::rename(newSaveFile, backupName);
+            index.Add(HistoryEntry{backupName, now, previousEncoded.size()});
         }
+    }
+
+    boost::filesystem::rename(tempSaveFile, newSaveFile);
+
+    // Remove old temporaries. Deleting a manifest frees the chunks only it was using.
+    auto &config = t_server->config;
+    const auto maxHistorySize = config.get<std::uint64_t>(nlohmann::json::value_t::number_unsigned, "serverConfig",
+                                                          "backups", "maxHistorySize");
+    const auto maxHistoryMB = config.get<std::uint64_t>(nlohmann::json::value_t::number_unsigned, "serverConfig",
+                                                        "backups", "maxHistoryMB");
+    const auto maxHistoryAge = config.get<std::uint64_t>(nlohmann::json::value_t::number_unsigned, "serverConfig",
+                                                         "backups", "maxHistoryAge");
+
+    for (const auto &expired : index.Trim(maxHistorySize, maxHistoryMB << 20, maxHistoryAge * 60, now)) {
+        t_server->logger.log(t_id, ": Over threshold; Removing ", expired.path.string());
 
+        if (expired.path.extension() == ".manifest")
+            store.Remove(expired.path);
+        else
+            boost::filesystem::remove(expired.path);
     }
+}
+
+bool EmulatorController::ReadHistoryState(ChunkStore &store, const boost::filesystem::path &entry,
+                                          std::vector<std::uint8_t> &state) {
+    if (entry.extension() == ".manifest")
+        return store.Get(entry, state);
 
-    std::ofstream fo(newSaveFile.string(), std::ios::binary);
-    fo.write(reinterpret_cast<char *>(saveData.data()), size);
+    // Current states that couldn't be decoded when they were moved to the history, kept as they were
+    std::vector<std::uint8_t> encoded;
+    return StateCodec::ReadFile(entry, encoded) && StateCodec::Decode(encoded.data(), encoded.size(), nullptr, state);
 }
 
 void EmulatorController::Backup() {
@@ -821,37 +1349,138 @@ void EmulatorController::Backup() {
             dataDirectory / "history" / "current.state")) // Create a current.state save if none exists
         Save();
 
-    std::unique_lock <std::shared_timed_mutex> lk(generalMutex);
+    // Most of what a backup writes is the state, so its size is what's counted against the IO rate limit
+    boost::system::error_code err;
+    const auto stateSize = boost::filesystem::file_size(dataDirectory / "history" / "current.state", err);
+
+    // Queued after any pending save, so current.state is up to date by the time this runs
+    auto t_dataDirectory = dataDirectory;
+    auto t_saveDirectory = saveDirectory;
+    auto store = chunkStore;
+    server->ioWorker.Queue([t_dataDirectory, t_saveDirectory, store]() {
+        WriteBackup(t_dataDirectory, t_saveDirectory, *store);
+    }, id, err ? 0 : stateSize);
+}
 
+void EmulatorController::WriteBackup(const boost::filesystem::path &t_dataDirectory,
+                                     const boost::filesystem::path &t_saveDirectory, ChunkStore &store) {
     namespace chrono = std::chrono;
     auto tp = chrono::system_clock::now().time_since_epoch();
     auto timestamp = std::to_string(chrono::duration_cast<chrono::seconds>(tp).count());
 
-    // Copy any emulator generated files over
-    auto currentBackup = dataDirectory / "backups" / timestamp;
+    // Copy any emulator generated files over, linking to the newest backup where nothing changed
+    const auto backupDirectory = t_dataDirectory / "backups";
+    auto currentBackup = backupDirectory / timestamp;
 
-    std::function<void(const boost::filesystem::path &, const boost::filesystem::path &)> recursive_copy;
-    recursive_copy = [&recursive_copy](const boost::filesystem::path &src, const boost::filesystem::path &dst) {
-        if (boost::filesystem::exists(dst)) {
-            return;
-        }
+    boost::filesystem::path previousBackup;
+    for (auto &p : boost::filesystem::directory_iterator(backupDirectory)) {
+        const auto &path = p.path();
+        const auto name = path.filename().string();
 
-        if (boost::filesystem::is_directory(src)) {
-            boost::filesystem::create_directories(dst);
-            for (auto &item : boost::filesystem::directory_iterator(src)) {
-                recursive_copy(item.path(), dst / item.path().filename());
-            }
-        } else if (boost::filesystem::is_regular_file(src)) {
-            boost::filesystem::copy(src, dst);
+        // Backup directories are named by timestamp, and compare as numbers when they're the same length
+        if (!boost::filesystem::is_directory(path) || name.empty() || name == timestamp ||
+            !std::all_of(name.begin(), name.end(), ::isdigit))
+            continue;
+
+        const auto previousName = previousBackup.filename().string();
+        if (previousBackup.empty() || name.size() > previousName.size() ||
+            (name.size() == previousName.size() && name > previousName))
+            previousBackup = path;
+    }
+
+    if (!boost::filesystem::is_empty(t_saveDirectory))
+        BackupIncremental(t_saveDirectory, currentBackup, previousBackup,
+                          previousBackup.empty() ? 0 : std::stoll(previousBackup.filename().string()));
+
+    // Snapshot the current history state, which is usually all chunks the history already has
+    std::vector<std::uint8_t> encoded, state;
+    if (StateCodec::ReadFile(t_dataDirectory / "history" / "current.state", encoded) &&
+        StateCodec::Decode(encoded.data(), encoded.size(), nullptr, state))
+        store.Put(t_dataDirectory / "backups" / "states" / (timestamp + ".manifest"), state.data(), state.size());
+}
+
+void EmulatorController::BackupIncremental(const boost::filesystem::path &src, const boost::filesystem::path &dst,
+                                           const boost::filesystem::path &previous, std::time_t previousTime) {
+    if (boost::filesystem::exists(dst))
+        return;
+
+    if (boost::filesystem::is_directory(src)) {
+        boost::filesystem::create_directories(dst);
+        for (auto &item : boost::filesystem::directory_iterator(src)) {
+            const auto filename = item.path().filename();
+            BackupIncremental(item.path(), dst / filename, previous.empty() ? previous : previous / filename,
+                              previousTime);
         }
+        return;
+    }
+
+    if (!boost::filesystem::is_regular_file(src))
+        return;
+
+    // Backups are never modified, so unchanged files can share the previous backup's copy
+    if (!previous.empty() && SameFile(src, previous, previousTime)) {
+        boost::system::error_code err;
+        boost::filesystem::create_hard_link(previous, dst, err);
+        if (!err)
+            return;
+    }
+
+    CloneFile(src, dst);
+}
+
+bool EmulatorController::SameFile(const boost::filesystem::path &a, const boost::filesystem::path &b,
+                                  std::time_t previousTime) {
+    boost::system::error_code err;
+    if (!boost::filesystem::is_regular_file(b, err) ||
+        boost::filesystem::file_size(a, err) != boost::filesystem::file_size(b, err) || err)
+        return false;
+
+    // Times only have a resolution of a second, so a file modified in the same second as the previous backup could
+    // have changed after it was copied without its time changing
+    const auto time = boost::filesystem::last_write_time(a, err);
+    if (time == boost::filesystem::last_write_time(b, err) && time < previousTime && !err)
+        return true;
+
+    // Saves get rewritten with the same contents a lot, so check before assuming it changed
+    auto hash = [](const boost::filesystem::path &path) {
+        std::ifstream in(path.string(), std::ios::binary);
+        if (!in)
+            return std::string();
+
+        MD5 md5;
+        std::vector<char> buffer(1 << 16);
+        while (in.read(buffer.data(), buffer.size()) || in.gcount() > 0)
+            md5.update(buffer.data(), static_cast<MD5::size_type>(in.gcount()));
+        return md5.finalize().hexdigest();
     };
 
-    if (!boost::filesystem::is_empty(saveDirectory))
-        recursive_copy(saveDirectory, currentBackup);
+    const auto hashA = hash(a);
+    return !hashA.empty() && hashA == hash(b);
+}
+
+void EmulatorController::CloneFile(const boost::filesystem::path &src, const boost::filesystem::path &dst) {
+    boost::system::error_code err;
+    bool copied{false};
+
+#if defined(__linux__) && defined(FICLONE)
+    const int in = open(src.string().c_str(), O_RDONLY | O_CLOEXEC);
+    if (in >= 0) {
+        const int out = open(dst.string().c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+        if (out >= 0) {
+            copied = ioctl(out, FICLONE, in) == 0;
+            close(out);
+
+            if (!copied)
+                boost::filesystem::remove(dst, err);
+        }
+        close(in);
+    }
+#endif
+
+    if (!copied)
+        boost::filesystem::copy_file(src, dst);
 
-    // Copy current history state over
-    boost::filesystem::copy(dataDirectory / "history" / "current.state",
-                          dataDirectory / "backups" / "states" / (timestamp + ".state"));
+    boost::filesystem::last_write_time(dst, boost::filesystem::last_write_time(src, err), err);
 }
 
 void EmulatorController::FastForward() {
@@ -864,20 +1493,418 @@ void EmulatorController::FastForward() {
         bool b = fastForward;
         b ^= true;
         fastForward = b;
+
+        fastForwardMultiplier = std::min(2u, maxFastForwardMultiplier);
+        lastFastForward = now;
     }
 }
 
 void EmulatorController::Load() {
     std::unique_lock <std::shared_timed_mutex> lk(generalMutex);
-    auto saveFile = dataDirectory / "history" / "current.state";
+    const auto historyDirectory = dataDirectory / "history";
+    auto saveFile = historyDirectory / "current.state";
 
     if (!boost::filesystem::exists(saveFile)) return; // Hasn't saved yet, so don't try to load it
 
-    auto saveFileSize = boost::filesystem::file_size(saveFile);
-    std::vector<unsigned char> saveData(saveFileSize);
+    std::vector<std::uint8_t> encoded, state;
+    if (!StateCodec::ReadFile(saveFile, encoded) ||
+        !StateCodec::Decode(encoded.data(), encoded.size(), nullptr, state)) {
+        server->logger.err(id, ": ", saveFile.string(), " is corrupt; Trying the newest history state.");
+
+        const auto history = historyIndex->entries();
+        if (history.empty() ||
+            !ReadHistoryState(*chunkStore, history.back().path, state))
+            return;
+
+        server->logger.log(id, ": Restored ", history.back().path.string());
+    }
+
+    Core.LoadState(state.data(), state.size());
+}
+
+void EmulatorController::RunFrame() {
+    runAheadPending = false;
+
+    // Nobody is watching, so there's no latency to hide
+    if (!runAheadFrames || (!users && !benchmarking)) {
+        StepFrame();
+        return;
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+
+    // The real frame isn't shown, the last one run ahead is
+    suppressVideo = true;
+    StepFrame();
+
+    const auto size = Core.SaveStateSize();
+    if (size > runAheadState.size())
+        runAheadState.resize(size);
+
+    if (size == 0 || !Core.SaveState(runAheadState.data(), size)) {
+        server->logger.log(id, ": Warning; Failed to serialize state for run-ahead. Disabling run-ahead.");
+        runAheadFrames = 0;
+        suppressVideo = false;
+        return;
+    }
+
+    if (runAheadSecondInstance && !runAheadCore.LoadState(runAheadState.data(), size)) {
+        server->logger.log(id, ": Warning; Second instance failed to load state. Falling back to single instance run-ahead.");
+        runAheadSecondInstance = false;
+    }
+
+    auto &core = runAheadSecondInstance ? runAheadCore : Core;
+    for (unsigned i = 1; i <= runAheadFrames; ++i) {
+        suppressVideo = (i != runAheadFrames);
+        core.Run();
+    }
+
+    runAheadStateSize = size;
+    runAheadPending = !runAheadSecondInstance;
+
+    runAheadTime += std::chrono::steady_clock::now() - start;
+    ++runAheadRuns;
+}
+
+void EmulatorController::StepFrame() {
+    if (replaying) {
+        replay.Apply(frameCount, replayPad);
+    } else {
+        inputQueue.Drain(joypad, forbiddenCombos);
+        recorder.Capture(frameCount, joypad);
+    }
+
+    Core.Run();
+    ++frameCount;
+
+    if (rewindBuffer.enabled() && ++framesSinceRewindCapture >= rewindInterval)
+        CaptureRewind();
+}
+
+void EmulatorController::CaptureRewind() {
+    framesSinceRewindCapture = 0;
+
+    const auto size = Core.SaveStateSize();
+    rewindState.resize(size);
+
+    if (size == 0 || !Core.SaveState(rewindState.data(), size)) {
+        server->logger.log(id, ": Warning; Can't serialize state, disabling rewind.");
+        rewindBuffer.Reset(0);
+        return;
+    }
+
+    rewindBuffer.Push(rewindState.data(), size);
+}
+
+void EmulatorController::Rewind(std::uint64_t seconds) {
+    if (!rewindBuffer.enabled()) {
+        server->logger.log(id, ": Rewind requested but rewinding is disabled.");
+        return;
+    }
+
+    const std::uint64_t frameMicroseconds = std::max<std::int64_t>(frameTime.count(), 1);
+
+    // Anything past the oldest state goes to the oldest state, and clamping first keeps the conversion from overflowing
+    const std::uint64_t maxSeconds = rewindBuffer.depth() * rewindInterval * frameMicroseconds / 1'000'000 + 1;
+    seconds = std::min(seconds, maxSeconds);
+
+    // Round up so that the state is from at least that long ago
+    const auto frames = seconds * 1'000'000 / frameMicroseconds;
+    const auto steps = (frames + rewindInterval - 1) / rewindInterval;
+
+    const auto taken = rewindBuffer.Rewind(steps, rewindState);
+    if (taken < 0 || !Core.LoadState(rewindState.data(), rewindState.size())) {
+        server->logger.err(id, ": Failed to rewind.");
+        return;
+    }
+
+    framesSinceRewindCapture = 0;
 
-    std::ifstream fi(saveFile.string(), std::ios::binary);
-    fi.read(reinterpret_cast<char *>(saveData.data()), saveFileSize);
+    // Input recorded so far doesn't lead to this state anymore
+    if (recorder.isOpen())
+        StartRecording();
+
+    server->logger.log(id, ": Rewound ", taken * rewindInterval * frameTime.count() / 1'000'000, " seconds.");
+}
+
+void EmulatorController::StartRecording() {
+    const auto size = Core.SaveStateSize();
+    std::vector<std::uint8_t> state(size);
+
+    if (size == 0 || !Core.SaveState(state.data(), size)) {
+        server->logger.log(id, ": Warning; Can't record input without save state support.");
+        return;
+    }
+
+    namespace chrono = std::chrono;
+    auto tp = chrono::system_clock::now().time_since_epoch();
+    auto timestamp = std::to_string(chrono::duration_cast<chrono::seconds>(tp).count());
+
+    boost::filesystem::create_directories(dataDirectory / "movies");
+    const auto moviePath = dataDirectory / "movies" / (timestamp + ".lpm");
+
+    if (!recorder.Open(moviePath.string(), state.data(), size)) {
+        server->logger.err(id, ": Failed to open ", moviePath.string(), " for recording input.");
+        return;
+    }
+
+    frameCount = 0;
+    server->logger.log(id, ": Recording input to ", moviePath.string());
+}
+
+bool EmulatorController::StartReplay(const std::string &moviePath) {
+    if (!replay.Open(moviePath)) {
+        server->logger.err(id, ": Failed to load movie ", moviePath);
+        return false;
+    }
+
+    if (!Core.LoadState(replay.state.data(), replay.state.size())) {
+        server->logger.err(id, ": Failed to load the starting state of ", moviePath);
+        return false;
+    }
+
+    replayPad.resetValues();
+    recorder.Close();
+    frameCount = 0;
+    replaying = true;
+
+    return true;
+}
+
+void EmulatorController::RunFastForward() {
+    const auto start = std::chrono::steady_clock::now();
+
+    // Only the last frame of the batch gets encoded and sent
+    suppressVideo = true;
+    for (unsigned i = 1; i < fastForwardMultiplier; ++i)
+        StepFrame();
+    suppressVideo = false;
+
+    RunFrame();
+
+    // Leave some of the tick for the work queue and encoding the frame
+    const auto elapsed = std::chrono::steady_clock::now() - start;
+    if (elapsed > (frameTime * 3) / 4 && fastForwardMultiplier > 1)
+        --fastForwardMultiplier;
+    else if (elapsed < frameTime / 2 && fastForwardMultiplier < maxFastForwardMultiplier)
+        ++fastForwardMultiplier;
+}
+
+void EmulatorController::RestoreRunAhead() {
+    if (!runAheadPending)
+        return;
+
+    const auto start = std::chrono::steady_clock::now();
+
+    if (!Core.LoadState(runAheadState.data(), runAheadStateSize)) {
+        server->logger.log(id, ": Warning; Failed to restore state after running ahead. Disabling run-ahead.");
+        runAheadFrames = 0;
+    }
+
+    runAheadPending = false;
+    runAheadTime += std::chrono::steady_clock::now() - start;
+}
+
+bool EmulatorController::LoadRunAheadInstance(const retro_game_info *info) {
+    // Same as the main core, the second instance needs its own copy of the library so that it gets its own globals
+    const auto corePath = dataDirectory / "emulator-runahead.so";
+    boost::filesystem::remove(corePath);
+    boost::filesystem::copy_file(dataDirectory / "emulator.so", corePath);
+
+    runAheadCore.Load(corePath.string().c_str());
+
+    const auto runAheadSaveDirectory = dataDirectory / "runahead-saves";
+    boost::system::error_code err;
+    boost::filesystem::remove_all(runAheadSaveDirectory, err);
+    boost::filesystem::create_directories(runAheadSaveDirectory, err);
+    runAheadSaveDirString = runAheadSaveDirectory.string();
+
+    runAheadCore.SetEnvironment(OnRunAheadEnvironment);
+    runAheadCore.SetVideoRefresh(OnVideoRefresh);
+    runAheadCore.SetInputPoll(OnPollInput);
+    runAheadCore.SetInputState(OnGetInputState);
+    runAheadCore.SetAudioSample(OnLRAudioSample);
+    runAheadCore.SetAudioSampleBatch(OnBatchAudioSample);
+    runAheadCore.Init();
+
+    if (info) {
+        if (!runAheadCore.LoadGame(info)) {
+            server->logger.err(id, ": Second instance failed to load the game. Falling back to single instance "
+                                   "run-ahead.");
+            return false;
+        }
+    } else if (supportsNoGame && !runAheadCore.LoadGame(nullptr)) {
+        server->logger.err(id, ": Second instance failed to start without a game. Falling back to single instance "
+                               "run-ahead.");
+        return false;
+    }
+
+    return true;
+}
+
+int EmulatorController::Benchmark(const BenchmarkOptions &options, LetsPlayServer *t_server) {
+    // Nothing the benchmark does is kept: the config isn't saved, and the emulator gets a throwaway directory instead
+    // of the one a real "benchmark" emulator would use, so no saved state is loaded and nothing is left behind
+    t_server->config.Detach();
+
+    const auto benchmarkDirectory = boost::filesystem::temp_directory_path() /
+                                    boost::filesystem::unique_path("letsplay-benchmark-%%%%-%%%%-%%%%");
+    t_server->emuDirectory = benchmarkDirectory;
+
+    struct DirectoryRemover {
+        LetsPlayServer *server;
+        boost::filesystem::path path;
+
+        ~DirectoryRemover() {
+            // Init queues a store rebuild that reads the directory
+            server->ioWorker.Flush();
+            boost::system::error_code err;
+            boost::filesystem::remove_all(path, err);
+        }
+    } remover{t_server, benchmarkDirectory};
+
+    // Only time the stages that were asked for, whatever the template turns on for real emulators
+    auto emuConfig = t_server->config.get<nlohmann::json>(nlohmann::json::value_t::object, "serverConfig",
+                                                          "emulators", "template");
+    if (!options.rewind)
+        emuConfig["rewind"]["interval"] = 0;
+    emuConfig["recordInput"] = options.recordInput;
+    emuConfig["runAhead"]["frames"] = options.runAheadFrames;
+    emuConfig["runAhead"]["secondInstance"] = options.runAheadSecondInstance;
+    t_server->config.set("serverConfig", "emulators", "benchmark", emuConfig);
+
+    if (!Init(options.corePath, options.romPath, t_server, "benchmark", "Benchmark"))
+        return 1;
+
+    if (!options.replayPath.empty() && !StartReplay(options.replayPath))
+        return 1;
+
+    using clock = std::chrono::steady_clock;
+
+    const bool convert = options.convert || options.encode;
+    std::chrono::nanoseconds emulateTime{0}, convertTime{0}, encodeTime{0}, fanOutTime{0};
+    std::uint64_t encodedBytes{0};
+
+    // Every encoded frame is sent to each mock connection the way SendFrame sends to every subscriber
+    MockServer mockServer;
+    mockServer.clear_access_channels(websocketpp::log::alevel::all);
+    mockServer.clear_error_channels(websocketpp::log::elevel::all);
+
+    std::vector<std::unique_ptr<MockConnection>> sinks;
+    for (std::uint64_t i = 0; i < options.sinks; ++i) {
+        std::unique_ptr<MockConnection> sink(new MockConnection);
+        sink->connection = mockServer.get_connection();
+        sink->connection->register_ostream(&sink->out);
+        sink->connection->start();
+
+        std::stringstream handshake;
+        handshake << "GET / HTTP/1.1\r\n"
+                     "Host: localhost\r\n"
+                     "Upgrade: websocket\r\n"
+                     "Connection: Upgrade\r\n"
+                     "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+                     "Sec-WebSocket-Version: 13\r\n\r\n";
+        handshake >> *sink->connection;
+
+        if (sink->connection->get_state() != websocketpp::session::state::open) {
+            server->logger.err(id, ": Failed to open a mock connection.");
+            return 1;
+        }
+
+        sinks.push_back(std::move(sink));
+    }
+
+    std::uint64_t handshakeBytes{0};
+    for (const auto &sink : sinks)
+        handshakeBytes += sink->buffer.count();
+
+    server->logger.log(id, ": Benchmarking ", options.frames, " frames...");
+
+    std::uint64_t frames{0};
+
+    // Runs ahead even without users
+    benchmarking = true;
+
+    const auto start = clock::now();
+    for (; frames < options.frames && !(replaying && replay.finished()); ++frames) {
+        auto stageStart = clock::now();
+        RunFrame();
+        emulateTime += clock::now() - stageStart;
+
+        if (convert) {
+            stageStart = clock::now();
+            const Frame frame = GetFrame();
+            convertTime += clock::now() - stageStart;
+
+            if (options.encode) {
+                stageStart = clock::now();
+                auto jpegData = server->EncodeJPEG(frame);
+                jpegData[0] = 0 | (kBinaryMessageType::Screen << 5);
+                encodeTime += clock::now() - stageStart;
+                encodedBytes += jpegData.size();
+
+                stageStart = clock::now();
+                const auto message = LetsPlayServer::PrepareMessage(jpegData.data(), jpegData.size(),
+                                                                    websocketpp::frame::opcode::binary);
+                for (auto &sink : sinks)
+                    sink->connection->send(message);
+                fanOutTime += clock::now() - stageStart;
+            }
+        }
+
+        // Same as Run, the roll back comes after the frame has been taken
+        stageStart = clock::now();
+        RestoreRunAhead();
+        emulateTime += clock::now() - stageStart;
+    }
+    const auto total = clock::now() - start;
+
+    benchmarking = false;
+
+    std::uint64_t sentBytes{0};
+    for (const auto &sink : sinks)
+        sentBytes += sink->buffer.count();
+    sentBytes -= handshakeBytes;
+
+    const auto perFrame = [&](const std::chrono::nanoseconds &time) {
+        return std::chrono::duration_cast<std::chrono::microseconds>(time).count() /
+               static_cast<double>(std::max<std::uint64_t>(frames, 1));
+    };
+
+    const double seconds = std::chrono::duration_cast<std::chrono::duration<double>>(total).count();
+
+    std::cout << "Core:        " << options.corePath << '\n'
+              << "Rom:         " << (options.romPath.empty() ? "(none)" : options.romPath) << '\n'
+              << "Replay:      " << (options.replayPath.empty() ? "(none)" : options.replayPath) << '\n'
+              << "Resolution:  " << videoFormat.width << 'x' << videoFormat.height << '\n'
+              << "Run-ahead:   " << runAheadFrames << " frame(s)"
+              << (runAheadFrames && runAheadSecondInstance ? " on a second instance" : "") << '\n'
+              << "Frames:      " << frames << " in " << seconds << "s\n"
+              << "FPS:         " << (seconds > 0 ? frames / seconds : 0) << " (native "
+              << avinfo.timing.fps << ")\n"
+              << "Emulate:     " << perFrame(emulateTime) << "us/frame\n";
+
+    if (convert)
+        std::cout << "Convert:     " << perFrame(convertTime) << "us/frame\n";
+
+    if (options.encode) {
+        std::cout << "Encode:      " << perFrame(encodeTime) << "us/frame, "
+                  << encodedBytes / std::max<std::uint64_t>(frames, 1) << " bytes/frame\n"
+                  << "Fan-out:     " << perFrame(fanOutTime) << "us/frame to " << options.sinks << " sink(s), "
+                  << sentBytes / std::max<std::uint64_t>(frames * options.sinks, 1) << " bytes/frame written to each\n";
+    }
+
+#if defined(__unix__) || defined(__APPLE__)
+    rusage usage{};
+    if (getrusage(RUSAGE_SELF, &usage) == 0) {
+#if defined(__APPLE__)
+        const auto peakKiB = usage.ru_maxrss / 1024;
+#else
+        const auto peakKiB = usage.ru_maxrss;
+#endif
+        std::cout << "Peak RSS:    " << peakKiB << " KiB\n";
+    }
+#endif
 
-    Core.LoadState(saveData.data(), saveFileSize);
+    return 0;
 }
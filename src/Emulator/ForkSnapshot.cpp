@@ -0,0 +1,101 @@
+#include "ForkSnapshot.h"
+
+#include <algorithm>
+#include <thread>
+
+#ifndef _WIN32
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+ForkSnapshot::ForkSnapshot(size_t size) : m_size{size} {}
+
+std::unique_ptr<ForkSnapshot> ForkSnapshot::Start(size_t size, const std::function<bool(void *, size_t)> &serialize) {
+#ifdef _WIN32
+    (void) size;
+    (void) serialize;
+    return nullptr;
+#else
+    std::unique_ptr<ForkSnapshot> snapshot(new ForkSnapshot(size));
+
+    void *buffer = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (buffer == MAP_FAILED)
+        return nullptr;
+    snapshot->m_buffer = static_cast<std::uint8_t *>(buffer);
+
+    const pid_t pid = fork();
+    if (pid < 0)
+        return nullptr;
+
+    if (pid == 0) {
+        // Child; _exit so that no destructors, atexit handlers or stdio flushes from the parent's state run here
+        _exit(serialize(buffer, size) ? 0 : 1);
+    }
+
+    snapshot->m_child = pid;
+    return snapshot;
+#endif
+}
+
+bool ForkSnapshot::Wait(std::chrono::milliseconds timeout, bool &timedOut) {
+    timedOut = false;
+#ifdef _WIN32
+    (void) timeout;
+    return false;
+#else
+    if (m_child < 0)
+        return false;
+
+    const auto deadline = std::chrono::steady_clock::now() + timeout;
+    auto poll = std::chrono::milliseconds(1);
+
+    int status{0};
+    while (true) {
+        const pid_t result = waitpid(m_child, &status, WNOHANG);
+
+        if (result == m_child)
+            break;
+
+        if (result < 0) { // Already reaped by someone else, so the result can't be trusted
+            m_child = -1;
+            return false;
+        }
+
+        if (std::chrono::steady_clock::now() >= deadline) {
+            kill(m_child, SIGKILL);
+            waitpid(m_child, &status, 0);
+            m_child = -1;
+            timedOut = true;
+            return false;
+        }
+
+        std::this_thread::sleep_for(poll);
+        poll = std::min(poll * 2, std::chrono::milliseconds(50));
+    }
+
+    m_child = -1;
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+#endif
+}
+
+const std::uint8_t *ForkSnapshot::data() const {
+    return m_buffer;
+}
+
+size_t ForkSnapshot::size() const {
+    return m_size;
+}
+
+ForkSnapshot::~ForkSnapshot() {
+#ifndef _WIN32
+    if (m_child > 0) {
+        kill(m_child, SIGKILL);
+        waitpid(m_child, nullptr, 0);
+    }
+
+    if (m_buffer)
+        munmap(m_buffer, m_size);
+#endif
+}
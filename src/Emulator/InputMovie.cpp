@@ -0,0 +1,189 @@
+#include "InputMovie.h"
+
+namespace {
+    /**
+     * Index/id pairs in the order InputRecorder::m_values stores them
+     */
+    struct PadValue {
+        unsigned index, id;
+    };
+
+    const std::array<PadValue, 20> padValues = [] {
+        std::array<PadValue, 20> values{};
+        for (unsigned id = 0; id < 16; ++id)
+            values[id] = {RETRO_DEVICE_INDEX_ANALOG_BUTTON, id};
+
+        values[16] = {RETRO_DEVICE_INDEX_ANALOG_LEFT, RETRO_DEVICE_ID_ANALOG_X};
+        values[17] = {RETRO_DEVICE_INDEX_ANALOG_LEFT, RETRO_DEVICE_ID_ANALOG_Y};
+        values[18] = {RETRO_DEVICE_INDEX_ANALOG_RIGHT, RETRO_DEVICE_ID_ANALOG_X};
+        values[19] = {RETRO_DEVICE_INDEX_ANALOG_RIGHT, RETRO_DEVICE_ID_ANALOG_Y};
+        return values;
+    }();
+
+    void writeVarint(std::ofstream &out, std::uint64_t value) {
+        do {
+            std::uint8_t byte = value & 0x7F;
+            value >>= 7;
+            if (value)
+                byte |= 0x80;
+            out.put(static_cast<char>(byte));
+        } while (value);
+    }
+}
+
+bool InputRecorder::Open(const std::string &path, const std::uint8_t *state, size_t stateSize) {
+    Close();
+
+    m_file.open(path, std::ios::binary | std::ios::trunc);
+    if (!m_file)
+        return false;
+
+    m_file.write("LPMV", 4);
+    m_file.put(static_cast<char>(kInputMovieVersion));
+    m_file.write("\0\0\0", 3);
+
+    for (unsigned i = 0; i < 8; ++i)
+        m_file.put(static_cast<char>((static_cast<std::uint64_t>(stateSize) >> (i * 8)) & 0xFF));
+    m_file.write(reinterpret_cast<const char *>(state), static_cast<std::streamsize>(stateSize));
+
+    m_lastEventFrame = m_lastFrame = 0;
+    m_values.fill(0);
+
+    return static_cast<bool>(m_file);
+}
+
+bool InputRecorder::isOpen() const {
+    return m_file.is_open();
+}
+
+void InputRecorder::writeEvent(std::uint64_t frame, unsigned index, unsigned id, std::int16_t value) {
+    writeVarint(m_file, frame - m_lastEventFrame);
+    m_file.put(static_cast<char>((index << 4) | id));
+
+    const auto bits = static_cast<std::uint16_t>(value);
+    m_file.put(static_cast<char>(bits & 0xFF));
+    m_file.put(static_cast<char>(bits >> 8));
+
+    m_lastEventFrame = frame;
+}
+
+void InputRecorder::Capture(std::uint64_t frame, RetroPad &pad) {
+    if (!m_file.is_open())
+        return;
+
+    for (size_t i = 0; i < padValues.size(); ++i) {
+        const auto value = pad.analogValue(padValues[i].index, padValues[i].id);
+        if (value != m_values[i]) {
+            writeEvent(frame, padValues[i].index, padValues[i].id, value);
+            m_values[i] = value;
+        }
+    }
+
+    m_lastFrame = frame;
+
+    // Keep the file mostly up to date since emulators usually run until the process is killed
+    if ((frame % 600) == 0)
+        m_file.flush();
+}
+
+void InputRecorder::Close() {
+    if (!m_file.is_open())
+        return;
+
+    writeVarint(m_file, m_lastFrame + 1 - m_lastEventFrame);
+    m_file.put(static_cast<char>(kInputMovieEnd));
+    m_file.close();
+}
+
+InputRecorder::~InputRecorder() {
+    Close();
+}
+
+bool InputReplay::Open(const std::string &path) {
+    m_finished = true;
+    m_events.clear();
+    state.clear();
+
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+        return false;
+
+    std::vector<std::uint8_t> data{std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>()};
+
+    if (data.size() < 16 || data[0] != 'L' || data[1] != 'P' || data[2] != 'M' || data[3] != 'V' ||
+        data[4] != kInputMovieVersion)
+        return false;
+
+    std::uint64_t stateSize{0};
+    for (unsigned i = 0; i < 8; ++i)
+        stateSize |= static_cast<std::uint64_t>(data[8 + i]) << (i * 8);
+
+    if (stateSize > data.size() - 16)
+        return false;
+
+    const auto stateBegin = data.begin() + 16;
+    state.assign(stateBegin, stateBegin + stateSize);
+    m_events.assign(stateBegin + stateSize, data.end());
+
+    m_position = 0;
+    m_nextFrame = 0;
+    m_finished = false;
+    readFrameDelta();
+
+    return true;
+}
+
+void InputReplay::readFrameDelta() {
+    std::uint64_t delta{0};
+    for (unsigned shift = 0; ; shift += 7) {
+        if (m_position >= m_events.size() || shift > 63) {
+            m_finished = true;
+            return;
+        }
+
+        const auto byte = m_events[m_position++];
+        delta |= static_cast<std::uint64_t>(byte & 0x7F) << shift;
+        if (!(byte & 0x80))
+            break;
+    }
+
+    m_nextFrame += delta;
+}
+
+void InputReplay::Apply(std::uint64_t frame, RetroPad &pad) {
+    while (!m_finished && m_nextFrame <= frame) {
+        if (m_position >= m_events.size()) {
+            m_finished = true;
+            break;
+        }
+
+        const auto key = m_events[m_position++];
+        if (key == kInputMovieEnd) {
+            m_finished = true;
+            break;
+        }
+
+        if (m_position + 2 > m_events.size()) {
+            m_finished = true;
+            break;
+        }
+
+        const auto value = static_cast<std::int16_t>(m_events[m_position] | (m_events[m_position + 1] << 8));
+        m_position += 2;
+
+        const unsigned index = key >> 4, id = key & 0x0F;
+        if (index <= RETRO_DEVICE_INDEX_ANALOG_BUTTON)
+            pad.updateValue(index, id, value);
+
+        readFrameDelta();
+    }
+
+    // The end marker sits on the frame after the last one recorded, so if that's next this was the last frame
+    if (!m_finished && m_nextFrame <= frame + 1 && m_position < m_events.size() &&
+        m_events[m_position] == kInputMovieEnd)
+        m_finished = true;
+}
+
+bool InputReplay::finished() const {
+    return m_finished;
+}
@@ -0,0 +1,119 @@
+#include "InputQueue.h"
+
+#include <array>
+#include <cstdlib>
+
+namespace {
+/**
+ * Index into Drain's per-control arrays: the 16 buttons, then the left and right sticks' X and Y
+ */
+unsigned controlOf(const QueuedInput &input) {
+    if (input.index == RETRO_DEVICE_INDEX_ANALOG_BUTTON)
+        return input.id;
+
+    return 16 + input.index * 2 + input.id;
+}
+
+bool isPressedValue(std::int16_t value) {
+    return std::abs(value) > ((2 << 14) - 1) / 2;
+}
+}
+
+InputQueue::InputQueue(size_t capacity) : m_capacity{capacity} {
+    m_incoming.reserve(capacity);
+    m_batch.reserve(capacity);
+}
+
+bool InputQueue::Push(const QueuedInput &input) {
+    std::unique_lock<std::mutex> lk(m_mutex);
+    if (m_incoming.size() >= m_capacity) {
+        ++m_dropped;
+        return false;
+    }
+
+    m_incoming.push_back(input);
+    return true;
+}
+
+void InputQueue::Drain(RetroPad &pad, const std::vector<std::bitset<16>> &forbiddenCombos) {
+    // Held back updates go first since they were received first
+    m_batch.clear();
+    m_batch.swap(m_deferred);
+    {
+        std::unique_lock<std::mutex> lk(m_mutex);
+        m_batch.insert(m_batch.end(), m_incoming.begin(), m_incoming.end());
+        m_incoming.clear();
+    }
+
+    if (m_batch.empty())
+        return;
+
+    constexpr unsigned controls = 16 + 4;
+
+    // Per control: the update that will be applied, whether its button already changed state this frame, and whether
+    // the rest of its updates wait for the next frame
+    std::array<std::int32_t, controls> latest;
+    latest.fill(-1);
+    std::array<bool, controls> toggled{}, deferred{};
+    const auto pressedAtStart = pad.getPressedState();
+
+    std::uint64_t coalesced{0}, dropped{0};
+    for (size_t i = 0; i < m_batch.size(); ++i) {
+        const auto &input = m_batch[i];
+        const auto control = controlOf(input);
+
+        if (!deferred[control] && input.index == RETRO_DEVICE_INDEX_ANALOG_BUTTON) {
+            const bool wasPressed = latest[control] >= 0 ? isPressedValue(m_batch[latest[control]].value)
+                                                         : pressedAtStart[input.id];
+
+            if (isPressedValue(input.value) != wasPressed) {
+                if (toggled[control])
+                    deferred[control] = true;
+                toggled[control] = true;
+            }
+        }
+
+        if (deferred[control]) {
+            if (m_deferred.size() < m_capacity)
+                m_deferred.push_back(input);
+            else
+                ++dropped;
+            continue;
+        }
+
+        if (latest[control] >= 0)
+            ++coalesced;
+        latest[control] = static_cast<std::int32_t>(i);
+        pad.markUpdated(input.received);
+    }
+
+    // Apply in the order they were received so that forbidden combos are checked against the right state
+    for (size_t i = 0; i < m_batch.size(); ++i) {
+        const auto &input = m_batch[i];
+        if (latest[controlOf(input)] != static_cast<std::int32_t>(i))
+            continue;
+
+        if (input.index == RETRO_DEVICE_INDEX_ANALOG_BUTTON)
+            pad.updateButton(input.id, input.value, forbiddenCombos);
+        else
+            pad.updateValue(input.index, input.id, input.value);
+    }
+
+    m_coalesced += coalesced;
+    m_dropped += dropped;
+}
+
+void InputQueue::Clear() {
+    m_deferred.clear();
+
+    std::unique_lock<std::mutex> lk(m_mutex);
+    m_incoming.clear();
+}
+
+std::uint64_t InputQueue::TakeCoalesced() {
+    return m_coalesced.exchange(0);
+}
+
+std::uint64_t InputQueue::TakeDropped() {
+    return m_dropped.exchange(0);
+}
@@ -21,6 +21,10 @@ std::int16_t RetroPad::analogValue(unsigned index, unsigned id) {
 void RetroPad::updateValue(unsigned index, unsigned id, std::int16_t value) {
     if (index == RETRO_DEVICE_INDEX_ANALOG_BUTTON) {
         m_buttonStates.at(id).value = value;
+        if (isPressed(id))
+            m_pressedState.fetch_or(static_cast<std::uint16_t>(1u << id));
+        else
+            m_pressedState.fetch_and(static_cast<std::uint16_t>(~(1u << id)));
         return;
     }
 
@@ -30,7 +34,49 @@ void RetroPad::updateValue(unsigned index, unsigned id, std::int16_t value) {
         m_stickStates.at(index).Y.value = value;
 }
 
+bool RetroPad::updateButton(unsigned id, std::int16_t value, const std::vector<std::bitset<16>> &forbiddenCombos) {
+    auto &button = m_buttonStates.at(id);
+    const bool pressed = std::abs(value) > ((2 << 14) - 1) / 2;
+
+    // Claim the pressed bit first so that two threads can't each complete half of a combo
+    std::uint16_t current = m_pressedState.load();
+    std::uint16_t next;
+    do {
+        next = pressed ? static_cast<std::uint16_t>(current | (1u << id))
+                       : static_cast<std::uint16_t>(current & ~(1u << id));
+
+        const std::bitset<16> potentialState{next};
+        for (const auto &forbiddenCombo : forbiddenCombos) {
+            if ((potentialState & forbiddenCombo) == forbiddenCombo)
+                return false;
+        }
+    } while (!m_pressedState.compare_exchange_weak(current, next));
+
+    button.value = value;
+    return true;
+}
+
+void RetroPad::markUpdated(std::chrono::steady_clock::time_point received) {
+    // Only the oldest unread update counts, later ones are read in the same poll
+    auto expected = std::chrono::steady_clock::rep{0};
+    m_pendingSince.compare_exchange_strong(expected, received.time_since_epoch().count());
+}
+
+bool RetroPad::takeUpdate(std::chrono::steady_clock::time_point &received) {
+    if (m_pendingSince.load(std::memory_order_relaxed) == 0)
+        return false;
+
+    const auto since = m_pendingSince.exchange(0);
+    if (since == 0)
+        return false;
+
+    received = std::chrono::steady_clock::time_point(std::chrono::steady_clock::duration(since));
+    return true;
+}
+
 void RetroPad::resetValues() {
+    m_pressedState = 0;
+
     for (auto &state : m_buttonStates) {
         state.value = 0;
     }
@@ -42,10 +88,5 @@ void RetroPad::resetValues() {
 }
 
 std::bitset<16> RetroPad::getPressedState() {
-    std::bitset<16> state;
-    for(int i = 0; i < state.size();++i) {
-        state[i] = this->isPressed(i);
-    }
-
-    return state;
+    return std::bitset<16>(m_pressedState.load());
 }
\ No newline at end of file
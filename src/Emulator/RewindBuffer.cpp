@@ -0,0 +1,84 @@
+#include "RewindBuffer.h"
+
+#include <algorithm>
+#include <cstring>
+
+void RewindBuffer::Reset(size_t capacity) {
+    m_arena.assign(capacity, 0);
+    m_arena.shrink_to_fit();
+    m_entries.clear();
+    m_head = 0;
+    m_hasLatest = false;
+}
+
+bool RewindBuffer::enabled() const {
+    return !m_arena.empty();
+}
+
+void RewindBuffer::Push(const std::uint8_t *state, size_t size) {
+    if (!enabled())
+        return;
+
+    if (m_hasLatest) {
+        // The previous newest state becomes a delta against this one
+        StateCodec::EncodeDelta(m_latest.data(), state, m_latest.size(), size, m_scratch);
+
+        if (m_scratch.size() > m_arena.size()) {
+            // Can't be stored, and everything older depends on it
+            m_entries.clear();
+            m_head = 0;
+        } else {
+            if (m_head + m_scratch.size() > m_arena.size())
+                m_head = 0;
+
+            const size_t begin = m_head, end = m_head + m_scratch.size();
+
+            // Entries are laid out in ring order, so dropping the newest entry in the way also means dropping
+            // everything older than it
+            size_t drop{0};
+            for (size_t i = 0; i < m_entries.size(); ++i) {
+                const auto &entry = m_entries[i];
+                if (entry.offset < end && entry.offset + entry.size > begin)
+                    drop = i + 1;
+            }
+            m_entries.erase(m_entries.begin(), m_entries.begin() + drop);
+
+            std::memcpy(m_arena.data() + begin, m_scratch.data(), m_scratch.size());
+            m_entries.push_back(Entry{begin, m_scratch.size()});
+            m_head = end;
+        }
+    }
+
+    m_latest.assign(state, state + size);
+    m_hasLatest = true;
+}
+
+size_t RewindBuffer::depth() const {
+    return m_entries.size();
+}
+
+long RewindBuffer::Rewind(size_t steps, std::vector<std::uint8_t> &state) {
+    if (!m_hasLatest)
+        return -1;
+
+    steps = std::min(steps, m_entries.size());
+
+    for (size_t i = 0; i < steps; ++i) {
+        const auto entry = m_entries.back();
+
+        if (!StateCodec::Decode(m_arena.data() + entry.offset, entry.size, &m_latest, m_decoded)) {
+            // Shouldn't happen, but what's left can't be trusted
+            m_entries.clear();
+            m_head = 0;
+            state = m_latest;
+            return static_cast<long>(i);
+        }
+
+        m_entries.pop_back();
+        m_head = m_entries.empty() ? 0 : m_entries.back().offset + m_entries.back().size;
+        std::swap(m_latest, m_decoded);
+    }
+
+    state = m_latest;
+    return static_cast<long>(steps);
+}
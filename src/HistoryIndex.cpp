@@ -0,0 +1,76 @@
+#include "HistoryIndex.h"
+
+#include <algorithm>
+#include <string>
+
+#include "ChunkStore.h"
+
+void HistoryIndex::Load(const boost::filesystem::path &historyDirectory) {
+    std::vector<HistoryEntry> found;
+
+    for (auto &p : boost::filesystem::directory_iterator(historyDirectory)) {
+        auto &path = p.path();
+
+        if (!boost::filesystem::is_regular_file(path) ||
+            (path.extension() != ".state" && path.extension() != ".manifest") || path.filename() == "current.state")
+            continue;
+
+        HistoryEntry entry{path, 0, 0};
+
+        // Entries are named by the time they were saved
+        const auto stem = path.stem().string();
+        if (!stem.empty() && std::all_of(stem.begin(), stem.end(), ::isdigit))
+            entry.time = static_cast<std::time_t>(std::stoll(stem));
+        else
+            entry.time = boost::filesystem::last_write_time(path);
+
+        std::vector<std::pair<std::string, std::uint64_t>> chunks;
+        if (path.extension() != ".manifest" || !ChunkStore::ReadManifest(path, entry.size, chunks))
+            entry.size = boost::filesystem::file_size(path);
+
+        found.push_back(entry);
+    }
+
+    std::sort(found.begin(), found.end(), [](const HistoryEntry &a, const HistoryEntry &b) {
+        return a.time < b.time || (a.time == b.time && a.path.stem().string() < b.path.stem().string());
+    });
+
+    std::unique_lock<std::mutex> lk(m_mutex);
+    m_entries.assign(found.begin(), found.end());
+    m_totalSize = 0;
+    for (const auto &entry : m_entries)
+        m_totalSize += entry.size;
+}
+
+void HistoryIndex::Add(const HistoryEntry &entry) {
+    std::unique_lock<std::mutex> lk(m_mutex);
+    m_entries.push_back(entry);
+    m_totalSize += entry.size;
+}
+
+std::vector<HistoryEntry> HistoryIndex::Trim(std::uint64_t maxCount, std::uint64_t maxSize, std::uint64_t maxAge,
+                                             std::time_t now) {
+    std::unique_lock<std::mutex> lk(m_mutex);
+
+    std::vector<HistoryEntry> dropped;
+    while (!m_entries.empty()) {
+        const auto &oldest = m_entries.front();
+
+        const bool overCount = maxCount && m_entries.size() > maxCount;
+        const bool overSize = maxSize && m_totalSize > maxSize;
+        const bool tooOld = maxAge && oldest.time + static_cast<std::time_t>(maxAge) < now;
+        if (!overCount && !overSize && !tooOld)
+            break;
+
+        m_totalSize -= oldest.size;
+        dropped.push_back(oldest);
+        m_entries.pop_front();
+    }
+
+    return dropped;
+}
+
+std::vector<HistoryEntry> HistoryIndex::entries() {
+    std::unique_lock<std::mutex> lk(m_mutex);
+    return std::vector<HistoryEntry>(m_entries.begin(), m_entries.end());
+}
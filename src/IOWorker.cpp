@@ -0,0 +1,146 @@
+#include "IOWorker.h"
+
+IOWorker::IOWorker(Logger &logger) : m_logger{logger} {
+    m_threads.emplace_back(&IOWorker::WorkerThread, this);
+}
+
+void IOWorker::Configure(unsigned threads, std::uint64_t bytesPerSecond, std::chrono::milliseconds lagWarning) {
+    {
+        std::unique_lock<std::mutex> lk(m_throttleMutex);
+        m_bytesPerSecond = bytesPerSecond;
+        m_tokens = static_cast<double>(bytesPerSecond);
+        m_lastRefill = std::chrono::steady_clock::now();
+    }
+
+    std::unique_lock<std::mutex> lk(m_mutex);
+    m_lagWarning = lagWarning;
+
+    if (!m_running)
+        return;
+
+    while (m_threads.size() < threads)
+        m_threads.emplace_back(&IOWorker::WorkerThread, this);
+}
+
+std::deque<IOWorker::Job>::iterator IOWorker::NextRunnable() {
+    // The first job for a key is always the oldest one, so this keeps per-key order
+    return std::find_if(m_jobs.begin(), m_jobs.end(),
+                        [&](const Job &job) { return job.key.empty() || !m_activeKeys.count(job.key); });
+}
+
+void IOWorker::Throttle(std::uint64_t bytes) {
+    using namespace std::chrono;
+
+    steady_clock::duration wait{0};
+    {
+        std::unique_lock<std::mutex> lk(m_throttleMutex);
+        if (m_bytesPerSecond == 0 || bytes == 0)
+            return;
+
+        // Refill, allowing at most a second's worth of burst
+        const auto now = steady_clock::now();
+        const auto rate = static_cast<double>(m_bytesPerSecond);
+        m_tokens = std::min(rate, m_tokens + duration<double>(now - m_lastRefill).count() * rate);
+        m_lastRefill = now;
+
+        m_tokens -= static_cast<double>(bytes);
+        if (m_tokens < 0)
+            wait = duration_cast<steady_clock::duration>(duration<double>(-m_tokens / rate));
+    }
+
+    if (wait.count() > 0)
+        std::this_thread::sleep_for(wait);
+}
+
+void IOWorker::WorkerThread() {
+    using namespace std::chrono;
+
+    while (true) {
+        Job job;
+        {
+            std::unique_lock<std::mutex> lk(m_mutex);
+            auto next = m_jobs.end();
+            m_notifier.wait(lk, [&]() {
+                next = NextRunnable();
+                return next != m_jobs.end() || (m_jobs.empty() && !m_running);
+            });
+
+            if (next == m_jobs.end()) // Stopped and drained
+                break;
+
+            job = std::move(*next);
+            m_jobs.erase(next);
+            m_activeKeys.insert(job.key);
+            ++m_busy;
+
+            const auto lag = duration_cast<milliseconds>(steady_clock::now() - job.queued);
+            m_maxLag = std::max(m_maxLag, lag);
+            if (m_lagWarning.count() && lag > m_lagWarning)
+                m_logger.log("IO job", job.key.empty() ? "" : " for " + job.key, " waited ", lag.count(),
+                             "ms in the queue (", m_jobs.size(), " still queued).");
+        }
+
+        Throttle(job.bytes);
+
+        try {
+            job.run();
+        } catch (const std::exception &e) {
+            m_logger.err("IO job failed: ", e.what());
+        }
+
+        {
+            std::unique_lock<std::mutex> lk(m_mutex);
+            m_activeKeys.erase(m_activeKeys.find(job.key));
+            --m_busy;
+            if (m_jobs.empty() && !m_busy)
+                m_idleNotifier.notify_all();
+        }
+
+        // Jobs waiting on this job's key can run now
+        m_notifier.notify_all();
+    }
+}
+
+void IOWorker::Queue(std::function<void()> job, const std::string &key, std::uint64_t bytes) {
+    {
+        std::unique_lock<std::mutex> lk(m_mutex);
+        if (m_running) {
+            m_jobs.push_back(Job{std::move(job), key, bytes, std::chrono::steady_clock::now()});
+            m_notifier.notify_one();
+            return;
+        }
+    }
+
+    // Nothing left to run it, so don't lose it
+    job();
+}
+
+std::chrono::milliseconds IOWorker::TakeMaxLag() {
+    std::unique_lock<std::mutex> lk(m_mutex);
+    const auto lag = m_maxLag;
+    m_maxLag = std::chrono::milliseconds(0);
+    return lag;
+}
+
+void IOWorker::Flush() {
+    std::unique_lock<std::mutex> lk(m_mutex);
+    m_idleNotifier.wait(lk, [&]() { return m_jobs.empty() && !m_busy; });
+}
+
+void IOWorker::Stop() {
+    std::vector<std::thread> threads;
+    {
+        std::unique_lock<std::mutex> lk(m_mutex);
+        m_running = false;
+        threads.swap(m_threads);
+    }
+    m_notifier.notify_all();
+
+    for (auto &thread : threads)
+        if (thread.joinable())
+            thread.join();
+}
+
+IOWorker::~IOWorker() {
+    Stop();
+}
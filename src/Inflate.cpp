@@ -0,0 +1,398 @@
+#include "Inflate.h"
+
+#include <cstring>
+
+namespace {
+    constexpr size_t inputSize{64 * 1024};
+    constexpr size_t windowSize{32 * 1024};
+
+    constexpr std::uint16_t lengthBase[29] = {3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51,
+                                              59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+    constexpr std::uint8_t lengthExtra[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4,
+                                              4, 5, 5, 5, 5, 0};
+    constexpr std::uint16_t distanceBase[30] = {1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385,
+                                                513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385,
+                                                24577};
+    constexpr std::uint8_t distanceExtra[30] = {0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9,
+                                                10, 10, 11, 11, 12, 12, 13, 13};
+
+    /**
+     * Order the code length code lengths are sent in
+     */
+    constexpr std::uint8_t codeLengthOrder[19] = {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+
+    /**
+     * Tables for slicing-by-4 CRC-32, crcTables[0] being the usual byte at a time table
+     */
+    const std::array<std::array<std::uint32_t, 256>, 4> crcTables = [] {
+        std::array<std::array<std::uint32_t, 256>, 4> tables{};
+        for (std::uint32_t i = 0; i < 256; ++i) {
+            std::uint32_t c = i;
+            for (unsigned k = 0; k < 8; ++k)
+                c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            tables[0][i] = c;
+        }
+
+        for (std::uint32_t i = 0; i < 256; ++i) {
+            for (unsigned t = 1; t < 4; ++t)
+                tables[t][i] = (tables[t - 1][i] >> 8) ^ tables[0][tables[t - 1][i] & 0xFF];
+        }
+        return tables;
+    }();
+}
+
+constexpr unsigned Inflater::Huffman::fastBits;
+
+bool Inflater::Huffman::Build(const std::uint8_t *lengths, unsigned n) {
+    count.fill(0);
+    fast.fill(0);
+
+    for (unsigned s = 0; s < n; ++s)
+        ++count[lengths[s]];
+
+    if (count[0] == n) // No codes, fine as long as nothing is decoded with it
+        return true;
+
+    // Over-subscribed codes are invalid, incomplete ones are allowed
+    int left = 1;
+    for (unsigned len = 1; len < 16; ++len) {
+        left <<= 1;
+        left -= count[len];
+        if (left < 0)
+            return false;
+    }
+
+    std::array<std::uint16_t, 16> offsets{};
+    for (unsigned len = 1; len < 15; ++len)
+        offsets[len + 1] = offsets[len] + count[len];
+
+    // First code of each length (RFC 1951 3.2.2), count[0] being unused symbols rather than codes
+    std::array<std::uint16_t, 16> nextCode{};
+    for (unsigned len = 2, code = 0; len < 16; ++len) {
+        code = (code + count[len - 1]) << 1;
+        nextCode[len] = static_cast<std::uint16_t>(code);
+    }
+
+    for (unsigned s = 0; s < n; ++s) {
+        const unsigned len = lengths[s];
+        if (!len)
+            continue;
+
+        symbol[offsets[len]++] = static_cast<std::uint16_t>(s);
+
+        const unsigned code = nextCode[len]++;
+        if (len > fastBits)
+            continue;
+
+        // Codes are sent most significant bit first, but the bit buffer is least significant first
+        unsigned reversed{0};
+        for (unsigned i = 0; i < len; ++i)
+            reversed |= ((code >> i) & 1) << (len - 1 - i);
+
+        for (unsigned i = reversed; i < fast.size(); i += 1u << len)
+            fast[i] = static_cast<std::uint16_t>((len << 9) | s);
+    }
+
+    return true;
+}
+
+Inflater::Inflater(std::istream &in, std::ostream &out, std::uint64_t limit)
+        : m_in{in}, m_out{out}, m_input(inputSize), m_window(windowSize * 2), m_limit{limit} {}
+
+bool Inflater::Fill(unsigned bits) {
+    if (m_bitCount >= bits)
+        return true;
+
+    // Top up as much as fits at once rather than a byte per call
+    while (m_bitCount <= 56 && m_inputPosition < m_inputSize) {
+        m_bitBuffer |= static_cast<std::uint64_t>(m_input[m_inputPosition++]) << m_bitCount;
+        m_bitCount += 8;
+    }
+
+    while (m_bitCount < bits) {
+        if (m_inputPosition == m_inputSize) {
+            m_in.read(reinterpret_cast<char *>(m_input.data()), m_input.size());
+            m_inputSize = static_cast<size_t>(m_in.gcount());
+            m_inputPosition = 0;
+
+            if (m_inputSize == 0) {
+                // Lookahead can go a little past the end, actually using those bits is caught at the end
+                if (++m_padding > 8) {
+                    m_failed = true;
+                    return false;
+                }
+                m_bitCount += 8;
+                continue;
+            }
+        }
+
+        m_bitBuffer |= static_cast<std::uint64_t>(m_input[m_inputPosition++]) << m_bitCount;
+        m_bitCount += 8;
+    }
+
+    return true;
+}
+
+std::uint32_t Inflater::Bits(unsigned bits) {
+    if (!Fill(bits))
+        return 0;
+
+    const auto value = static_cast<std::uint32_t>(m_bitBuffer & ((1ull << bits) - 1));
+    m_bitBuffer >>= bits;
+    m_bitCount -= bits;
+    return value;
+}
+
+int Inflater::Decode(const Huffman &h) {
+    Fill(15);
+    if (m_failed)
+        return -1;
+
+    const auto entry = h.fast[m_bitBuffer & ((1u << Huffman::fastBits) - 1)];
+    if (entry) {
+        const unsigned len = entry >> 9;
+        m_bitBuffer >>= len;
+        m_bitCount -= len;
+        return entry & 0x1FF;
+    }
+
+    // Longer than fastBits, walk the code one bit at a time
+    int code{0}, first{0}, index{0};
+    for (unsigned len = 1; len < 16; ++len) {
+        code |= static_cast<int>(Bits(1));
+        const int count = h.count[len];
+        if (code - count < first)
+            return h.symbol[index + (code - first)];
+
+        index += count;
+        first += count;
+        first <<= 1;
+        code <<= 1;
+    }
+
+    return -1;
+}
+
+void Inflater::Put(std::uint8_t byte) {
+    if (m_windowPosition == m_window.size()) {
+        Flush();
+
+        // Keep the last window's worth for back references
+        std::memmove(m_window.data(), m_window.data() + m_window.size() - windowSize, windowSize);
+        m_windowPosition = m_flushed = windowSize;
+    }
+
+    m_window[m_windowPosition++] = byte;
+}
+
+void Inflater::Flush() {
+    const auto *data = m_window.data() + m_flushed;
+    const auto size = m_windowPosition - m_flushed;
+
+    m_crc = Crc32(m_crc, data, size);
+    m_out.write(reinterpret_cast<const char *>(data), size);
+    m_flushed = m_windowPosition;
+}
+
+bool Inflater::Stored() {
+    // Stored blocks start on a byte boundary
+    Bits(m_bitCount & 7);
+
+    const auto length = Bits(16), complement = Bits(16);
+    if (m_failed || length != (~complement & 0xFFFF))
+        return false;
+
+    if (m_total + length > m_limit)
+        return false;
+    m_total += length;
+
+    for (std::uint32_t i = 0; i < length; ++i) {
+        const auto byte = static_cast<std::uint8_t>(Bits(8));
+        if (m_failed)
+            return false;
+        Put(byte);
+    }
+
+    return true;
+}
+
+bool Inflater::Codes(const Huffman &lengthCode, const Huffman &distanceCode) {
+    while (true) {
+        int symbol = Decode(lengthCode);
+        if (symbol < 0)
+            return false;
+
+        if (symbol < 256) {
+            if (++m_total > m_limit)
+                return false;
+            Put(static_cast<std::uint8_t>(symbol));
+            continue;
+        }
+
+        if (symbol == 256)
+            return true;
+
+        symbol -= 257;
+        if (symbol >= 29)
+            return false;
+
+        const unsigned length = lengthBase[symbol] + Bits(lengthExtra[symbol]);
+
+        symbol = Decode(distanceCode);
+        if (symbol < 0 || symbol >= 30)
+            return false;
+
+        const std::uint64_t distance = distanceBase[symbol] + Bits(distanceExtra[symbol]);
+        if (m_failed || distance > m_total || distance > windowSize)
+            return false;
+
+        if ((m_total += length) > m_limit)
+            return false;
+
+        // Byte at a time since the source and destination can overlap
+        if (m_windowPosition + length <= m_window.size()) {
+            std::uint8_t *out = m_window.data() + m_windowPosition;
+            const std::uint8_t *from = out - distance;
+            for (unsigned i = 0; i < length; ++i)
+                out[i] = from[i];
+            m_windowPosition += length;
+        } else {
+            // The source is read before Put slides the window
+            for (unsigned i = 0; i < length; ++i)
+                Put(m_window[m_windowPosition - distance]);
+        }
+    }
+}
+
+bool Inflater::Fixed() {
+    static const auto codes = [] {
+        std::pair<Huffman, Huffman> tables;
+        std::uint8_t lengths[288];
+
+        std::memset(lengths, 8, 144);
+        std::memset(lengths + 144, 9, 112);
+        std::memset(lengths + 256, 7, 24);
+        std::memset(lengths + 280, 8, 8);
+        tables.first.Build(lengths, 288);
+
+        std::memset(lengths, 5, 30);
+        tables.second.Build(lengths, 30);
+
+        return tables;
+    }();
+
+    return Codes(codes.first, codes.second);
+}
+
+bool Inflater::Dynamic() {
+    const unsigned lengthCount = Bits(5) + 257, distanceCount = Bits(5) + 1, codeLengthCount = Bits(4) + 4;
+    if (m_failed || lengthCount > 286 || distanceCount > 30)
+        return false;
+
+    std::uint8_t lengths[320]{};
+    for (unsigned i = 0; i < codeLengthCount; ++i)
+        lengths[codeLengthOrder[i]] = static_cast<std::uint8_t>(Bits(3));
+
+    Huffman codeLengthCode;
+    if (!codeLengthCode.Build(lengths, 19))
+        return false;
+
+    std::memset(lengths, 0, sizeof(lengths));
+    for (unsigned i = 0; i < lengthCount + distanceCount;) {
+        const int symbol = Decode(codeLengthCode);
+        if (symbol < 0)
+            return false;
+
+        if (symbol < 16) {
+            lengths[i++] = static_cast<std::uint8_t>(symbol);
+            continue;
+        }
+
+        std::uint8_t value{0};
+        unsigned repeat;
+        if (symbol == 16) {
+            if (i == 0)
+                return false;
+            value = lengths[i - 1];
+            repeat = 3 + Bits(2);
+        } else if (symbol == 17) {
+            repeat = 3 + Bits(3);
+        } else {
+            repeat = 11 + Bits(7);
+        }
+
+        if (i + repeat > lengthCount + distanceCount)
+            return false;
+
+        while (repeat--)
+            lengths[i++] = value;
+    }
+
+    // Blocks have to be able to end
+    if (lengths[256] == 0)
+        return false;
+
+    Huffman lengthCode, distanceCode;
+    if (!lengthCode.Build(lengths, lengthCount) || !distanceCode.Build(lengths + lengthCount, distanceCount))
+        return false;
+
+    return Codes(lengthCode, distanceCode);
+}
+
+bool Inflater::Run() {
+    bool last;
+    do {
+        last = Bits(1) != 0;
+
+        bool ok;
+        switch (Bits(2)) {
+            case 0:
+                ok = Stored();
+                break;
+            case 1:
+                ok = Fixed();
+                break;
+            case 2:
+                ok = Dynamic();
+                break;
+            default:
+                ok = false;
+                break;
+        }
+
+        if (!ok || m_failed)
+            return false;
+    } while (!last);
+
+    Flush();
+
+    // Padding bytes that were actually decoded mean the input was cut short
+    return m_padding * 8 <= m_bitCount && static_cast<bool>(m_out);
+}
+
+bool Inflater::Inflate(std::istream &in, std::ostream &out, std::uint64_t limit, std::uint32_t &crc,
+                       std::uint64_t &size) {
+    Inflater inflater(in, out, limit);
+    const bool ok = inflater.Run();
+
+    crc = inflater.m_crc;
+    size = inflater.m_total;
+    return ok;
+}
+
+std::uint32_t Inflater::Crc32(std::uint32_t crc, const std::uint8_t *data, size_t size) {
+    crc = ~crc;
+
+    size_t i{0};
+    for (; i + 4 <= size; i += 4) {
+        crc ^= static_cast<std::uint32_t>(data[i]) | static_cast<std::uint32_t>(data[i + 1]) << 8 |
+               static_cast<std::uint32_t>(data[i + 2]) << 16 | static_cast<std::uint32_t>(data[i + 3]) << 24;
+        crc = crcTables[3][crc & 0xFF] ^ crcTables[2][(crc >> 8) & 0xFF] ^ crcTables[1][(crc >> 16) & 0xFF] ^
+              crcTables[0][crc >> 24];
+    }
+
+    for (; i < size; ++i)
+        crc = crcTables[0][(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+
+    return ~crc;
+}
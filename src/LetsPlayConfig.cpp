@@ -13,6 +13,23 @@ nlohmann::json LetsPlayConfig::defaultConfig = R"json(
                 "overrideFramerate": false,
                 "forbiddenCombos": [],
                 "fps": 60,
+                "recordInput": false,
+                "romCopyOnWrite": false,
+                "fastForward": {
+                    "maxMultiplier": 4
+                },
+                "runAhead": {
+                    "frames": 0,
+                    "secondInstance": false
+                },
+                "rewind": {
+                    "interval": 60,
+                    "memoryMB": 32
+                },
+                "forkSnapshots": {
+                    "enabled": false,
+                    "timeout": 10000
+                },
                 "muting": {
                     "messagesPerInterval": 3,
                     "intervalTime": 4,
@@ -24,11 +41,22 @@ nlohmann::json LetsPlayConfig::defaultConfig = R"json(
         "backups": {
             "backupInterval": 1440,
             "historyInterval": 5,
-            "maxHistorySize": 288
+            "maxHistorySize": 288,
+            "maxHistoryMB": 0,
+            "maxHistoryAge": 0,
+            "stagger": true
+        },
+        "io": {
+            "threads": 2,
+            "maxWriteMBps": 0,
+            "lagWarning": 5000
         },
         "salt": "ncft9PlmVA",
         "adminHash": "be23396d825c5a17c57c7738ac4b98a5",
         "dataDirectory": "System Default",
+        "networkThreads": 0,
+        "commandThreads": 0,
+        "romCacheMB": 4096,
         "jpegQuality": 80,
         "heartbeatTimeout": 3000,
         "maxMessageSize": 100,
@@ -43,6 +71,14 @@ nlohmann::json LetsPlayConfig::defaultConfig = R"json(
         },
         "mGBA": {
             "mgba_solar_sensor_level": 5
+        },
+        "MockCore": {
+            "mockcore_scene": "scroll",
+            "mockcore_pixel_format": "rgb565",
+            "mockcore_width": 256,
+            "mockcore_height": 224,
+            "mockcore_tone_hz": 440,
+            "mockcore_state_size": 65536
         }
     }
 }
@@ -71,11 +107,19 @@ void LetsPlayConfig::LoadFrom(const boost::filesystem::path& path) {
 }
 
 void LetsPlayConfig::SaveConfig() {
+    if (m_configPath.empty())
+        return;
+
     std::shared_lock<std::shared_timed_mutex> lk(mutex, std::try_to_lock);
     std::ofstream fo(m_configPath.string());
     fo << std::setw(4) << config;
 }
 
+void LetsPlayConfig::Detach() {
+    std::unique_lock<std::shared_timed_mutex> lk(mutex);
+    m_configPath.clear();
+}
+
 LetsPlayConfig::~LetsPlayConfig() {
     SaveConfig();
 }
@@ -1,52 +1,116 @@
 #include "LetsPlayProtocol.h"
 
-std::string LetsPlayProtocol::encode(const std::vector<std::string>& chunks) {
-    std::ostringstream oss;
-    for (const auto& chunk : chunks) {
-        oss << chunk.size();
-        oss << '.';
-        oss << chunk;
-        oss << ',';
-    }
+#include <cstring>
 
-    std::string out = oss.str();
-    out.back() = ';';
+std::string LetsPlayProtocol::encode(const std::vector<std::string>& chunks) {
+    std::string out;
+    encodeInto(out, chunks);
     return out;
 }
 
+void LetsPlayProtocol::encodeInto(std::string& encoded, const std::vector<std::string>& chunks) {
+    size_t size{0};
+    for (const auto& chunk : chunks)
+        size += encodedSize(chunk.size());
+
+    encoded.resize(size);
+    if (chunks.empty()) return;
+
+    char *out = &encoded[0];
+    for (const auto& chunk : chunks)
+        out = writeChunk(out, chunk);
+
+    encoded.back() = ';';
+}
+
+size_t LetsPlayProtocol::encodedSize(size_t contentSize) {
+    size_t digits{1};
+    for (size_t n = contentSize; n >= 10; n /= 10)
+        ++digits;
+
+    return digits + 1 + contentSize + 1;
+}
+
+char *LetsPlayProtocol::writeChunk(char *out, boost::string_view content) {
+    // Length, written backwards from its last digit
+    char *end = out + encodedSize(content.size()) - content.size() - 2;
+    char *digit = end;
+    size_t length = content.size();
+    do {
+        *--digit = static_cast<char>('0' + length % 10);
+        length /= 10;
+    } while (length);
+
+    *end++ = '.';
+    std::memcpy(end, content.data(), content.size());
+    end += content.size();
+    *end++ = ',';
+
+    return end;
+}
+
 std::vector<std::string> LetsPlayProtocol::decode(const std::string& input) {
+    Chunks chunks;
+    const auto count = decode(input, chunks, 999);
+
     std::vector<std::string> output;
+    output.reserve(count);
+    for (size_t i = 0; i < count; ++i)
+        output.emplace_back(chunks[i].data(), chunks[i].size());
 
-    if (input.back() != ';') return output;
+    return output;
+}
 
-    std::istringstream iss{input};
-    while (iss) {
-        unsigned long long length{0};
-        // if length is greater than -1ull then length will just be equal to
-        // -1ull, no overflows here
-        iss >> length;
+size_t LetsPlayProtocol::decode(boost::string_view input, Chunks& chunks, size_t maxLength) {
+    if (input.empty() || input.back() != ';') return 0;
 
-        // TODO: Make the max received size equal to maxMessageSize (config value) multiplied by len("\u{1AAAA}") + len('4.chat,') + len(';'). Pass as a parameter to decode for keeping it static.
-        if (!iss || length >= 1'000) {
-            return std::vector<std::string>();
+    size_t count{0}, pos{0};
+    while (count < chunks.size()) {
+        // Length, which can't overflow since it stops being read once it's past maxLength
+        size_t length{0}, digits{0};
+        for (; pos < input.size() && input[pos] >= '0' && input[pos] <= '9'; ++pos, ++digits) {
+            length = length * 10 + static_cast<size_t>(input[pos] - '0');
+            if (length > maxLength) return 0;
         }
 
-        if (iss.peek() != '.') return std::vector<std::string>();
+        if (digits == 0 || pos >= input.size() || input[pos] != '.') return 0;
+        ++pos;  // remove the period
 
-        iss.get();  // remove the period
-//
-        std::vector<char> content(length + 1, '\0');
-        iss.read(content.data(), static_cast<std::streamsize>(length));
-        output.push_back(std::string(content.data()));
+        // Room for the contents and a separator after them
+        if (input.size() - pos <= length) return 0;
 
-        const char& separator = iss.peek();
-        if (separator != ',') {
-            if (separator == ';') return output;
+        chunks[count++] = input.substr(pos, length);
+        pos += length;
 
-            return std::vector<std::string>();
-        }
+        const char separator = input[pos++];
+        if (separator == ';') return pos == input.size() ? count : 0;
+        if (separator != ',') return 0;
+    }
+
+    return 0;
+}
 
-        iss.get();
+bool LetsPlayProtocol::decodeInput(const std::string& input, InputBatch& batch) {
+    constexpr size_t headerSize = 6, eventSize = 4;
+
+    if (input.size() < headerSize) return false;
+
+    const auto *bytes = reinterpret_cast<const std::uint8_t *>(input.data());
+    if (bytes[0] != inputMessageType) return false;
+
+    batch.count = bytes[1];
+    if (batch.count == 0 || batch.count > batch.events.size() || input.size() != headerSize + batch.count * eventSize)
+        return false;
+
+    batch.timestamp = static_cast<std::uint32_t>(bytes[2]) | static_cast<std::uint32_t>(bytes[3]) << 8 |
+                      static_cast<std::uint32_t>(bytes[4]) << 16 | static_cast<std::uint32_t>(bytes[5]) << 24;
+
+    for (size_t i = 0; i < batch.count; ++i) {
+        const std::uint8_t *event = bytes + headerSize + i * eventSize;
+        batch.events[i].device = event[0];
+        batch.events[i].id = event[1];
+        batch.events[i].value = static_cast<std::int16_t>(static_cast<std::uint16_t>(event[2] | event[3] << 8));
     }
-    return std::vector<std::string>();
+
+    return true;
 }
@@ -1,5 +1,87 @@
 #include "LetsPlayServer.h"
 
+#include <cstring>
+
+#include <websocketpp/processors/hybi13.hpp>
+
+namespace {
+struct CommandName {
+    const char *name;
+    size_t size;
+    kCommandType type;
+};
+
+/**
+ * Commands clients can send
+ */
+constexpr CommandName commandNames[] = {
+    {"list", 4, kCommandType::List},          // No params
+    {"chat", 4, kCommandType::Chat},          // message
+    {"username", 8, kCommandType::Username},  // newname
+    {"button", 6, kCommandType::Button},      // button id, 0/1 for keyup/keydown
+    {"connect", 7, kCommandType::Connect},    // emuid
+    {"turn", 4, kCommandType::Turn},          // No params
+    {"add", 3, kCommandType::AddEmu},
+    {"admin", 5, kCommandType::Admin},
+    {"addemu", 6, kCommandType::AddEmu},
+    {"shutdown", 8, kCommandType::Shutdown},
+    {"ff", 2, kCommandType::FastForward},
+    {"rewind", 6, kCommandType::Rewind},      // seconds
+    {"pong", 4, kCommandType::Pong},
+};
+
+constexpr size_t commandTableSize = 32;
+
+/**
+ * Perfect hash of the command names, picked so that no two of them share a slot
+ */
+constexpr size_t commandHash(const char *name, size_t size) {
+    return (static_cast<unsigned char>(name[0]) + 11 * static_cast<unsigned char>(name[size - 1]) + size) %
+           commandTableSize;
+}
+
+struct CommandTable {
+    CommandName slots[commandTableSize];
+};
+
+constexpr CommandTable makeCommandTable() {
+    CommandTable table{};
+    for (const auto &command : commandNames)
+        table.slots[commandHash(command.name, command.size)] = command;
+    return table;
+}
+
+constexpr bool commandHashIsPerfect() {
+    for (const auto &a : commandNames) {
+        for (const auto &b : commandNames) {
+            if (&a != &b && commandHash(a.name, a.size) == commandHash(b.name, b.size))
+                return false;
+        }
+    }
+    return true;
+}
+
+static_assert(commandHashIsPerfect(), "Two command names hash to the same slot, change commandHash");
+
+constexpr CommandTable commandTable = makeCommandTable();
+
+/**
+ * @return The command with the given name, or kCommandType::Unknown
+ */
+kCommandType LookupCommand(boost::string_view name) {
+    if (name.empty())
+        return kCommandType::Unknown;
+
+    const auto &slot = commandTable.slots[commandHash(name.data(), name.size())];
+    if (slot.name && slot.size == name.size() && std::memcmp(slot.name, name.data(), name.size()) == 0)
+        return slot.type;
+
+    return kCommandType::Unknown;
+}
+}
+
+const std::string LetsPlayServer::serverLane;
+
 LetsPlayServer::LetsPlayServer(boost::filesystem::path& configFile) { config.LoadFrom(configFile); }
 
 void LetsPlayServer::Run(std::uint16_t port) {
@@ -28,9 +110,26 @@ void LetsPlayServer::Run(std::uint16_t port) {
             throw std::runtime_error(std::string("Failed to listen on port ") +
                 std::to_string(port));
 
-        m_QueueThreadRunning = true;
+        m_Running = true;
 
-        m_QueueThread = std::thread{[&]() { this->QueueThread(); }};
+        auto commandThreads = config.get<std::uint64_t>(nlohmann::json::value_t::number_unsigned, "serverConfig",
+                                                        "commandThreads");
+        if (commandThreads == 0)
+            commandThreads = std::max(std::thread::hardware_concurrency(), 1u);
+
+        m_Lanes.Start(commandThreads, [this](PooledCommand &command) { this->ProcessCommand(*command); });
+
+        // Chat messages can be maxMessageSize characters long, each escaped as up to 9 bytes (\u{1XXXX})
+        m_MaxChunkSize = std::max<size_t>(
+                999, 9 * config.get<std::uint64_t>(nlohmann::json::value_t::number_unsigned, "serverConfig",
+                                                   "maxMessageSize"));
+
+        ioWorker.Configure(
+                config.get<std::uint64_t>(nlohmann::json::value_t::number_unsigned, "serverConfig", "io", "threads"),
+                config.get<std::uint64_t>(nlohmann::json::value_t::number_unsigned, "serverConfig", "io",
+                                          "maxWriteMBps") << 20,
+                std::chrono::milliseconds(config.get<std::uint64_t>(nlohmann::json::value_t::number_unsigned,
+                                                                    "serverConfig", "io", "lagWarning")));
 
         // Schedule periodic tasks
         auto savePeriod = std::chrono::minutes(
@@ -45,24 +144,67 @@ void LetsPlayServer::Run(std::uint16_t port) {
         std::function<void()> saveFunc = [&]() { this->SaveTask(); };
         std::function<void()> backupFunc = [&]() { this->BackupTask(); };
         std::function<void()> pingFunc = [&]() { this->PingTask(); };
+        std::function<void()> laneFunc = [&]() { this->LaneTask(); };
 
         scheduler.Schedule(saveFunc, savePeriod);
         scheduler.Schedule(backupFunc, backupPeriod);
         scheduler.Schedule(previewFunc, std::chrono::seconds(20));
         scheduler.Schedule(pingFunc, std::chrono::seconds(5));
+        scheduler.Schedule(laneFunc, std::chrono::minutes(1));
 
         // Skip having to connect, change username, addemu
         {
-            std::unique_lock<std::mutex> lk(m_QueueMutex);
-            m_WorkQueue.push(
-                    Command{kCommandType::AddEmu, {"emu1", "./core", "./rom", "Test Emu"}, {}, ""});
-            //m_WorkQueue.push(
+            auto addEmu = MakeCommand(kCommandType::AddEmu, {}, 4);
+            addEmu->params = {"emu1", "./core", "./rom", "Test Emu"};
+            QueueCommand(std::move(addEmu));
+            //QueueCommand(
             //        Command{kCommandType::AddEmu, {"emu2", "./snes9x.so", "./Earthbound.smc", "Earthbound (SNES)"}, {}, ""});
-            m_QueueNotifier.notify_one();
         }
 
         server->start_accept();
+
+        // Handlers for a connection run one at a time through that connection's strand (the asio transport does
+        // this when multithreading is enabled), but handlers for different connections run in parallel
+        auto networkThreads = config.get<std::uint64_t>(nlohmann::json::value_t::number_unsigned, "serverConfig",
+                                                        "networkThreads");
+        if (networkThreads == 0)
+            networkThreads = std::max(std::thread::hardware_concurrency(), 1u);
+
+        logger.log("Running the network on ", networkThreads, " thread(s).");
+
+        // Joined however Run is left, since destroying a joinable std::thread terminates the process. If the main
+        // thread's run() throws, the server is stopped first so that the other threads return too.
+        struct NetworkPool {
+            std::shared_ptr<wcpp_server> server;
+            std::vector<std::thread> threads;
+
+            void Join() {
+                for (auto &thread : threads)
+                    if (thread.joinable())
+                        thread.join();
+            }
+
+            ~NetworkPool() {
+                if (std::any_of(threads.begin(), threads.end(), [](const std::thread &t) { return t.joinable(); }))
+                    server->stop();
+                Join();
+            }
+        } networkPool{server, {}};
+
+        for (std::uint64_t i = 1; i < networkThreads; ++i) {
+            networkPool.threads.emplace_back([this]() {
+                try {
+                    server->run();
+                } catch (websocketpp::exception const &e) {
+                    logger.err(e.what());
+                } catch (std::exception const &e) {
+                    logger.err("Network thread stopped: ", e.what());
+                }
+            });
+        }
+
         server->run();
+        networkPool.Join();
 
         this->Shutdown();
     } catch (websocketpp::exception const& e) {
@@ -109,6 +251,7 @@ void LetsPlayServer::OnConnect(websocketpp::connection_hdl hdl) {
         logger.log('<', hdl.lock(), "> -> ", user->uuid(), " -> [", user->IP(), ']');
 
         m_Users[hdl] = user;
+        PublishUsers();
     }
 
     // Send available emulators
@@ -151,11 +294,7 @@ void LetsPlayServer::OnConnect(websocketpp::connection_hdl hdl) {
     }
 
     // Put a preview send request on queue
-    {
-        std::unique_lock<std::mutex> lk(m_QueueMutex);
-        m_WorkQueue.push(Command{kCommandType::Preview, {}, hdl, ""});
-        m_QueueNotifier.notify_one();
-    }
+    QueueCommand(MakeCommand(kCommandType::Preview, hdl, 0));
 }
 
 void LetsPlayServer::OnDisconnect(websocketpp::connection_hdl hdl) {
@@ -201,7 +340,14 @@ void LetsPlayServer::OnDisconnect(websocketpp::connection_hdl hdl) {
 
         // Double check is on purpose
         search = m_Users.find(hdl);
-        if (search != m_Users.end()) m_Users.erase(search);
+        if (search != m_Users.end()) {
+            auto subscribers = m_Subscribers.find(search->second->connectedEmu());
+            if (subscribers != m_Subscribers.end())
+                subscribers->second.erase(hdl);
+
+            m_Users.erase(search);
+            PublishUsers();
+        }
     }
 }
 
@@ -317,53 +463,34 @@ void LetsPlayServer::OnHTTP(websocketpp::connection_hdl hdl) {
 }
 
 void LetsPlayServer::OnMessage(websocketpp::connection_hdl hdl, wcpp_server::message_ptr msg) {
+    const auto received = std::chrono::steady_clock::now();
     const std::string& data = msg->get_payload();
-    const auto decoded = LetsPlayProtocol::decode(data);
-
-    if (decoded.empty()) return;
-    const auto& command = decoded.at(0);
-    kCommandType t = kCommandType::Unknown;
-
-    if (command == "list")  // No params
-        t = kCommandType::List;
-    else if (command == "chat")  // message
-        t = kCommandType::Chat;
-    else if (command == "username")  // newname
-        t = kCommandType::Username;
-    else if (command == "button")  // button id, 0/1 for keyup/keydown
-        t = kCommandType::Button;
-    else if (command == "connect")  // emuid
-        t = kCommandType::Connect;
-    else if (command == "turn")  // No params
-        t = kCommandType::Turn;
-    else if (command == "add")
-        t = kCommandType::AddEmu;
-    else if (command == "admin")
-        t = kCommandType::Admin;
-    else if (command == "addemu")
-        t = kCommandType::AddEmu;
-    else if (command == "shutdown")
-        t = kCommandType::Shutdown;
-    else if (command == "ff")
-        t = kCommandType::FastForward;
-    else if (command == "pong")
-        t = kCommandType::Pong;
-    else
+
+    if (msg->get_opcode() == websocketpp::frame::opcode::binary) {
+        OnInputMessage(hdl, data, received);
         return;
+    }
 
-    EmuID_t emuID;
-    LetsPlayUserHdl user_hdl;
+    LetsPlayProtocol::Chunks decoded;
+    const size_t chunkCount = LetsPlayProtocol::decode(data, decoded, m_MaxChunkSize);
 
-    //
+    if (chunkCount == 0) return;
+    const kCommandType t = LookupCommand(decoded[0]);
+    if (t == kCommandType::Unknown)
+        return;
+
+    auto c = MakeCommand(t, hdl, chunkCount - 1);
     {
         std::unique_lock<std::mutex> lk(m_UsersMutex);
-        if (m_Users.find(hdl) != m_Users.end()) {
-            user_hdl = m_Users[hdl];
-            if (auto user = user_hdl.lock())
-                emuID = user->connectedEmu();
+        auto search = m_Users.find(hdl);
+        if (search != m_Users.end()) {
+            c->user_hdl = search->second;
+            c->emuID = search->second->connectedEmu();
         }
     }
 
+    const auto& user_hdl = c->user_hdl;
+
     if (auto user = user_hdl.lock())
         logger.log(user->uuid(), " (", user->username(), ") raw: '", data, '\'');
 
@@ -376,52 +503,160 @@ void LetsPlayServer::OnMessage(websocketpp::connection_hdl hdl, wcpp_server::mes
         }
     }
 
-    Command c{t, std::vector<std::string>(), hdl, emuID, user_hdl};
-    if (decoded.size() > 1)
-        c.params = std::vector<std::string>(decoded.begin() + 1, decoded.end());
+    for (size_t i = 1; i < chunkCount; ++i)
+        c->params[i - 1].assign(decoded[i].data(), decoded[i].size());
 
-    {
-        std::unique_lock<std::mutex> lk(m_QueueMutex);
-        m_WorkQueue.push(c);
+    // Input doesn't wait behind everything else in the work queue
+    if (t == kCommandType::Button) {
+        OnButton(*c, received);
+        return;
     }
 
-    m_QueueNotifier.notify_one();
+    QueueCommand(std::move(c));
 }
 
-void LetsPlayServer::Shutdown() {
-    // Run this function once
-    static bool shuttingdown = false;
+PooledCommand LetsPlayServer::MakeCommand(kCommandType type, websocketpp::connection_hdl hdl, size_t paramCount) {
+    auto command = m_CommandPool.Acquire();
+    command->type = type;
+    command->hdl = std::move(hdl);
+    command->emuID.clear();
+    command->user_hdl.reset();
+
+    // Shrinking keeps the vector's and the remaining strings' memory for next time
+    command->params.resize(paramCount);
+
+    return command;
+}
 
-    if (!shuttingdown)
-        shuttingdown = true;
-    else
+void LetsPlayServer::OnButton(const Command& command, std::chrono::steady_clock::time_point received) {
+    // button/leftStick/rightStick, button id, value as int16
+    if (command.params.size() != 3) return;
+
+    {
+        auto user = command.user_hdl.lock();
+        if (!user || (!user->hasTurn && !user->hasAdmin)) return;
+    }
+
+    const auto &buttonType = command.params[0];
+    std::int16_t id, value;
+
+    // Spaghet
+    {
+        std::stringstream ss{command.params[1]};
+        ss >> id;
+        if (!ss)
+            return;
+    }
+    {
+        std::stringstream ss{command.params[2]};
+        ss >> value;
+        if (!ss)
+            return;
+    }
+
+    if (auto user = command.user_hdl.lock())
+        logger.log(user->uuid(),
+                   " (",
+                   user->username(),
+                   ") sent a '",
+                   buttonType,
+                   "' update with id '",
+                   id,
+                   "' and value '",
+                   value,
+                   '\'');
+
+    if (command.emuID.empty())
         return;
 
-    // Stop the work thread loop
-    m_QueueThreadRunning = false;
-    logger.log("Stopping work thread...");
+    if (buttonType == "button")
+        ApplyInput(command.emuID, kInputDevice::Button, id, value, received);
+    else if (buttonType == "leftStick")
+        ApplyInput(command.emuID, kInputDevice::LeftStick, id, value, received);
+    else if (buttonType == "rightStick")
+        ApplyInput(command.emuID, kInputDevice::RightStick, id, value, received);
+}
+
+void LetsPlayServer::OnInputMessage(websocketpp::connection_hdl hdl, const std::string& data,
+                                    std::chrono::steady_clock::time_point received) {
+    LetsPlayProtocol::InputBatch batch;
+    if (!LetsPlayProtocol::decodeInput(data, batch))
+        return;
+
+    std::shared_ptr<LetsPlayUser> user;
     {
-        logger.log("Emptying the queue...");
-        // Empty the queue ...
-        std::unique_lock<std::mutex> lk(m_QueueMutex);
-        while (!m_WorkQueue.empty()) m_WorkQueue.pop();
-        // ... Except for a shutdown command
-        m_WorkQueue.push(Command{kCommandType::Shutdown, std::vector<std::string>(),
-                                 websocketpp::connection_hdl(), ""});
+        std::unique_lock<std::mutex> lk(m_UsersMutex);
+        auto it = m_Users.find(hdl);
+        if (it != m_Users.end())
+            user = it->second;
+    }
+
+    if (!user || (!user->hasTurn && !user->hasAdmin))
+        return;
+
+    const EmuID_t emuID = user->connectedEmu();
+    if (emuID.empty())
+        return;
+
+    for (size_t i = 0; i < batch.count; ++i) {
+        const auto &event = batch.events[i];
+        if (event.device > static_cast<std::uint8_t>(kInputDevice::RightStick))
+            continue;
+
+        ApplyInput(emuID, static_cast<kInputDevice>(event.device), event.id, event.value, received);
+    }
+}
+
+bool LetsPlayServer::ApplyInput(const EmuID_t& emuID, kInputDevice device, std::int16_t id, std::int16_t value,
+                                std::chrono::steady_clock::time_point received) {
+    if (id < 0)
+        return false;
+
+    unsigned index{RETRO_DEVICE_INDEX_ANALOG_BUTTON};
+    switch (device) {
+        case kInputDevice::Button:
+            if (id > 15)
+                return false;
+            break;
+        case kInputDevice::LeftStick:
+            if (id > 1)
+                return false;
+            index = RETRO_DEVICE_INDEX_ANALOG_LEFT;
+            break;
+        case kInputDevice::RightStick:
+            if (id > 1)
+                return false;
+            index = RETRO_DEVICE_INDEX_ANALOG_RIGHT;
+            break;
     }
 
+    std::unique_lock<std::mutex> lk(m_EmusMutex);
+    auto it = m_Emus.find(emuID);
+    if (it == m_Emus.end() || !it->second)
+        return false;
+
+    return it->second->inputQueue->Push(QueuedInput{index, static_cast<unsigned>(id), value, received});
+}
+
+void LetsPlayServer::Shutdown() {
+    // Run this function once, even if several network threads ask for it
+    static std::atomic<bool> shuttingdown{false};
+
+    if (shuttingdown.exchange(true))
+        return;
+
+    m_Running = false;
+    m_StaggerNotifier.notify_all();
+
     logger.log("Stopping listen...");
     // Stop listening so the queue doesn't grow any more
     websocketpp::lib::error_code err;
     server->stop_listening(err);
     if (err)
         logger.err("Error stopping listen ", err.message());
-    // Wake up the turn and work threads
-    logger.log("Waking up work thread...");
-    m_QueueNotifier.notify_one();
-    // Wait until they stop looping
-    logger.log("Waiting for work thread to stop...");
-    m_QueueThread.join();
+    // Drop the queued commands and wait for the running ones to finish
+    logger.log("Stopping command threads...");
+    m_Lanes.Stop();
 
     // Close every connection
     {
@@ -433,568 +668,558 @@ void LetsPlayServer::Shutdown() {
                 server->close(hdl, websocketpp::close::status::normal, "Closing", err);
         }
     }
-}
-
-void LetsPlayServer::QueueThread() {
-    while (m_QueueThreadRunning) {
-        std::unique_lock<std::mutex> lk(m_QueueMutex);
-        // Use std::condition_variable::wait Predicate?
-        while (m_WorkQueue.empty()) m_QueueNotifier.wait(lk);
 
-        if (!m_WorkQueue.empty()) {
-            auto &command = m_WorkQueue.front();
+    // Finish writing any queued states and backups
+    logger.log("Waiting for queued writes...");
+    ioWorker.Flush();
+}
 
-            switch (command.type) {
-                case kCommandType::Chat: {
-                    // Chat has only one, the message
-                    if (command.params.size() != 1) break;
+void LetsPlayServer::QueueCommand(PooledCommand command) {
+    // Commands that touch every user or the list of emulators run in order with each other
+    const bool serverWide = command->type == kCommandType::Username || command->type == kCommandType::AddEmu;
+    const std::string &lane = serverWide ? serverLane : command->emuID;
 
-                    if (auto user = command.user_hdl.lock()) {
-                        if (user->username().empty())
-                            break;
+    m_Lanes.Post(lane, std::move(command));
+}
 
-                        if (user->connectedEmu().empty())
-                            break;
+void LetsPlayServer::ProcessCommand(Command &command) {
+    switch (command.type) {
+        case kCommandType::Chat: {
+            // Chat has only one, the message
+            if (command.params.size() != 1) break;
 
-                        // Message only has values in the range of typeable
-                        // ascii characters excluding \n and \t
-                        if (!LetsPlayServer::isAsciiStr(command.params[0])) break;
+            if (auto user = command.user_hdl.lock()) {
+                if (user->username().empty())
+                    break;
 
-                        auto maxMessageSize = config.get<std::uint64_t>(nlohmann::json::value_t::number_unsigned,
-                                                                        "serverConfig", "maxMessageSize");
+                if (user->connectedEmu().empty())
+                    break;
 
-                        if (LetsPlayServer::escapedSize(command.params[0]) > maxMessageSize) break;
+                // Message only has values in the range of typeable
+                // ascii characters excluding \n and \t
+                if (!LetsPlayServer::isAsciiStr(command.params[0])) break;
 
-                        std::unique_lock<std::mutex> lk(this->m_MutesMutex);
-                        auto& ip = m_Mutes[user->IP()];
+                auto maxMessageSize = config.get<std::uint64_t>(nlohmann::json::value_t::number_unsigned,
+                                                                "serverConfig", "maxMessageSize");
 
-                        if(ip.isMuted) {
-                            if(std::chrono::steady_clock::now() < ip.muteTime)
-                                break;
+                if (LetsPlayServer::escapedSize(command.params[0]) > maxMessageSize) break;
 
-                            /* Here, the user would be marked as muted but their mute should expire, so
-                             * update mute state and allow this message */
-                            ip.isMuted = false;
-                            logger.log("Unmuting ", user->IP(), ".");
-                        }
+                std::unique_lock<std::mutex> lk(this->m_MutesMutex);
+                auto& ip = m_Mutes[user->IP()];
 
-                        auto messagesPerInterval = config.get<std::uint64_t>(nlohmann::json::value_t::number_unsigned,
-                                                                             "serverConfig", "emulators", user->connectedEmu(), "muting", "messagesPerInterval");
+                if(ip.isMuted) {
+                    if(std::chrono::steady_clock::now() < ip.muteTime)
+                        break;
 
-                        auto& messageTimestamps = ip.messageTimestamps;
+                    /* Here, the user would be marked as muted but their mute should expire, so
+                     * update mute state and allow this message */
+                    ip.isMuted = false;
+                    logger.log("Unmuting ", user->IP(), ".");
+                }
 
-                        // Should mute?
-                        if(!ip.isMuted) {
-                            logger.log("Checking mute eligibility");
-                            auto intervalTime = config.get<std::uint64_t>(nlohmann::json::value_t::number_unsigned,
-                                                                          "serverConfig", "emulators", user->connectedEmu(), "muting", "intervalTime");
-                            auto muteTime = config.get<std::uint64_t>(nlohmann::json::value_t::number_unsigned,
-                                                                      "serverConfig", "emulators", user->connectedEmu(), "muting", "muteTime");
+                auto messagesPerInterval = config.get<std::uint64_t>(nlohmann::json::value_t::number_unsigned,
+                                                                     "serverConfig", "emulators", user->connectedEmu(), "muting", "messagesPerInterval");
+
+                auto& messageTimestamps = ip.messageTimestamps;
+
+                // Should mute?
+                if(!ip.isMuted) {
+                    logger.log("Checking mute eligibility");
+                    auto intervalTime = config.get<std::uint64_t>(nlohmann::json::value_t::number_unsigned,
+                                                                  "serverConfig", "emulators", user->connectedEmu(), "muting", "intervalTime");
+                    auto muteTime = config.get<std::uint64_t>(nlohmann::json::value_t::number_unsigned,
+                                                              "serverConfig", "emulators", user->connectedEmu(), "muting", "muteTime");
+
+                    /* Mutable as in able to be muted. This counts messages that are sent within
+                     * the last intervalTime seconds */
+                    auto mutableMessages = std::count_if(messageTimestamps.begin(), messageTimestamps.end(), [&](const auto& timestamp) {
+                        return timestamp > std::chrono::steady_clock::now() - std::chrono::seconds(intervalTime);
+                    });
+
+                    logger.log("mutableMessages: ", mutableMessages);
+                    if((mutableMessages + 1) > messagesPerInterval) {
+                        logger.log("(", user->username(), ") was muted for ", muteTime, " seconds.");
+                        ip.muteTime = std::chrono::steady_clock::now() + std::chrono::seconds(muteTime);
+                        ip.isMuted = true;
+                        BroadcastOne(LetsPlayProtocol::encode("mute", muteTime), command.hdl);
+                        break;
+                    }
 
-                            /* Mutable as in able to be muted. This counts messages that are sent within
-                             * the last intervalTime seconds */
-                            auto mutableMessages = std::count_if(messageTimestamps.begin(), messageTimestamps.end(), [&](const auto& timestamp) {
-                                return timestamp > std::chrono::steady_clock::now() - std::chrono::seconds(intervalTime);
-                            });
+                }
 
-                            logger.log("mutableMessages: ", mutableMessages);
-                            if((mutableMessages + 1) > messagesPerInterval) {
-                                logger.log("(", user->username(), ") was muted for ", muteTime, " seconds.");
-                                ip.muteTime = std::chrono::steady_clock::now() + std::chrono::seconds(muteTime);
-                                ip.isMuted = true;
-                                BroadcastOne(LetsPlayProtocol::encode("mute", muteTime), command.hdl);
-                                break;
-                            }
+                BroadcastToEmu(user->connectedEmu(),
+                               LetsPlayProtocol::encode("chat", user->username(), command.params[0]),
+                               websocketpp::frame::opcode::text
+                );
 
-                        }
+                // IP was allowed to send, so update message timestamps
+                if(messageTimestamps.size() >= messagesPerInterval)
+                    messageTimestamps.erase(messageTimestamps.begin());
 
-                        BroadcastToEmu(user->connectedEmu(),
-                                       LetsPlayProtocol::encode("chat", user->username(), command.params[0]),
-                                       websocketpp::frame::opcode::text
-                        );
+                messageTimestamps.push_back(std::chrono::steady_clock::now());
 
-                        // IP was allowed to send, so update message timestamps
-                        if(messageTimestamps.size() >= messagesPerInterval)
-                            messageTimestamps.erase(messageTimestamps.begin());
+                logger.log(user->uuid(), " (", user->username(), "): '", command.params[0], '\'');
+            }
+        }
+            break;
+        case kCommandType::Username: {
+            // Username has only one param, the username
+            if (command.params.size() != 1) break;
+
+            if (auto user = command.user_hdl.lock()) {
+                const auto &newUsername = command.params.at(0);
+                const auto oldUsername = user->username();
+
+                std::unique_lock<std::mutex> lkk(m_MutesMutex);
+                auto& ip = m_Mutes[user->IP()];
+
+                // TODO: Message muting for no man's land
+                const auto renameCooldown = config.get<std::uint64_t>(nlohmann::json::value_t::number_unsigned, "serverConfig", "usernameChangeCooldown");
+
+                logger.log((ip.lastRename + std::chrono::milliseconds(renameCooldown)).time_since_epoch().count());
+                // If the user sent another rename within the cooldown period, skip it
+                if(ip.lastRename + std::chrono::milliseconds(renameCooldown) > std::chrono::steady_clock::now()) {
+                    BroadcastOne(
+                            LetsPlayProtocol::encode("username", oldUsername, oldUsername),
+                            command.hdl);
+                    logger.log(user->uuid(),
+                               " (",
+                               user->username(),
+                               ") was rate-limited when changing username to '",
+                               newUsername,
+                               '\'');
+                    break;
+                }
 
-                        messageTimestamps.push_back(std::chrono::steady_clock::now());
+                const bool justJoined = oldUsername.empty();
+
+                // Ignore no change if haven't just joined
+                if (newUsername == oldUsername && !justJoined) {
+                    // Treat as invalid if they haven't just joined and they tried to request a new username
+                    // that's the same as their current one
+                    BroadcastOne(
+                            LetsPlayProtocol::encode("username", oldUsername, oldUsername),
+                            command.hdl);
+                    logger.log(user->uuid(),
+                               " (",
+                               user->username(),
+                               ") failed username change to : '",
+                               newUsername,
+                               '\'');
+                    break;
+                }
 
-                        logger.log(user->uuid(), " (", user->username(), "): '", command.params[0], '\'');
+                auto maxUsernameLen = config.get<std::uint64_t>(nlohmann::json::value_t::number_unsigned,
+                                                                "serverConfig", "maxUsernameLength"),
+                        minUsernameLen = config.get<std::uint64_t>(nlohmann::json::value_t::number_unsigned,
+                                                                   "serverConfig", "minUsernameLength");
+
+                // Size based checks
+                if (newUsername.size() > maxUsernameLen
+                    || newUsername.size() < minUsernameLen) {
+                    if (justJoined)
+                        GiveGuest(command.hdl, command.user_hdl);
+                    else {
+                        BroadcastOne(
+                                LetsPlayProtocol::encode("username", oldUsername, oldUsername),
+                                command.hdl);
+                        logger.log(user->uuid(),
+                                   " (",
+                                   user->username(),
+                                   ") failed username change to '",
+                                   newUsername,
+                                   "' due to length.");
                     }
-                }
                     break;
-                case kCommandType::Username: {
-                    // Username has only one param, the username
-                    if (command.params.size() != 1) break;
-
-                    if (auto user = command.user_hdl.lock()) {
-                        const auto &newUsername = command.params.at(0);
-                        const auto oldUsername = user->username();
-
-                        std::unique_lock<std::mutex> lkk(m_MutesMutex);
-                        auto& ip = m_Mutes[user->IP()];
-
-                        // TODO: Message muting for no man's land
-                        const auto renameCooldown = config.get<std::uint64_t>(nlohmann::json::value_t::number_unsigned, "serverConfig", "usernameChangeCooldown");
-
-                        logger.log((ip.lastRename + std::chrono::milliseconds(renameCooldown)).time_since_epoch().count());
-                        // If the user sent another rename within the cooldown period, skip it
-                        if(ip.lastRename + std::chrono::milliseconds(renameCooldown) > std::chrono::steady_clock::now()) {
-                            BroadcastOne(
-                                    LetsPlayProtocol::encode("username", oldUsername, oldUsername),
-                                    command.hdl);
-                            logger.log(user->uuid(),
-                                       " (",
-                                       user->username(),
-                                       ") was rate-limited when changing username to '",
-                                       newUsername,
-                                       '\'');
-                            break;
-                        }
-
-                        const bool justJoined = oldUsername.empty();
-
-                        // Ignore no change if haven't just joined
-                        if (newUsername == oldUsername && !justJoined) {
-                            // Treat as invalid if they haven't just joined and they tried to request a new username
-                            // that's the same as their current one
-                            BroadcastOne(
-                                    LetsPlayProtocol::encode("username", oldUsername, oldUsername),
-                                    command.hdl);
-                            logger.log(user->uuid(),
-                                       " (",
-                                       user->username(),
-                                       ") failed username change to : '",
-                                       newUsername,
-                                       '\'');
-                            break;
-                        }
-
-                        auto maxUsernameLen = config.get<std::uint64_t>(nlohmann::json::value_t::number_unsigned,
-                                                                        "serverConfig", "maxUsernameLength"),
-                                minUsernameLen = config.get<std::uint64_t>(nlohmann::json::value_t::number_unsigned,
-                                                                           "serverConfig", "minUsernameLength");
-
-                        // Size based checks
-                        if (newUsername.size() > maxUsernameLen
-                            || newUsername.size() < minUsernameLen) {
-                            if (justJoined)
-                                GiveGuest(command.hdl, command.user_hdl);
-                            else {
-                                BroadcastOne(
-                                        LetsPlayProtocol::encode("username", oldUsername, oldUsername),
-                                        command.hdl);
-                                logger.log(user->uuid(),
-                                           " (",
-                                           user->username(),
-                                           ") failed username change to '",
-                                           newUsername,
-                                           "' due to length.");
-                            }
-                            break;
-                        }
-
-                        // Content based checks
-                        if (newUsername.front() == ' ' || newUsername.back() == ' ' // Spaces at beginning/end
-                            || !LetsPlayServer::isAsciiStr(newUsername)         // Non-ascii printable characters
-                            || (newUsername.find("  ") != std::string::npos)) { // Double spaces inside username
-                            if (justJoined)
-                                GiveGuest(command.hdl, command.user_hdl);
-                            else {
-                                BroadcastOne(
-                                        LetsPlayProtocol::encode("username", oldUsername, oldUsername),
-                                        command.hdl);
-                                logger.log(user->uuid(),
-                                           " (",
-                                           user->username(),
-                                           ") failed username change to '",
-                                           newUsername,
-                                           "' due to content.");
-                            }
-                            break;
-                        }
-
-                        // Finally, check if username is already taken
-                        if (UsernameTaken(newUsername, user->uuid())) {
-                            if (justJoined)
-                                GiveGuest(command.hdl, command.user_hdl);
-                            else {
-                                BroadcastOne(
-                                        LetsPlayProtocol::encode("username", oldUsername, oldUsername),
-                                        command.hdl);
-                                logger.log(user->uuid(),
-                                           " (",
-                                           user->username(),
-                                           ") failed username change to '",
-                                           newUsername,
-                                           "' because its already taken.");
-                            }
-                            break;
-                        }
-
-                        /*
-                         * If all checks were passed, set username and broadcast to the person that they have a new
-                         * username, and send a join/rename to everyone if the person just joined/has been around
-                         */
-                        user->setUsername(newUsername);
-                        ip.lastRename = std::chrono::steady_clock::now();
+                }
 
+                // Content based checks
+                if (newUsername.front() == ' ' || newUsername.back() == ' ' // Spaces at beginning/end
+                    || !LetsPlayServer::isAsciiStr(newUsername)         // Non-ascii printable characters
+                    || (newUsername.find("  ") != std::string::npos)) { // Double spaces inside username
+                    if (justJoined)
+                        GiveGuest(command.hdl, command.user_hdl);
+                    else {
                         BroadcastOne(
-                                LetsPlayProtocol::encode("username", oldUsername, newUsername),
-                                command.hdl
-                        );
-
-                        logger.log(user->uuid(), " (", user->username(), ") set username to '", newUsername, '\'');
-
-                        if (justJoined) { // Send a join message
-                            BroadcastToEmu(
-                                    user->connectedEmu(),
-                                    LetsPlayProtocol::encode("join", user->username()),
-                                    websocketpp::frame::opcode::text);
-
-                            logger.log(user->uuid(), " (", user->username(), ") joined.");
-                        } else { // Tell everyone on the emu someone changed their username
-                            BroadcastToEmu(user->connectedEmu(),
-                                           LetsPlayProtocol::encode("rename", oldUsername, newUsername),
-                                           websocketpp::frame::opcode::text);
-                            logger.log(user->uuid(),
-                                       " (",
-                                       user->username(),
-                                       "): ",
-                                       oldUsername,
-                                       " is now known as ",
-                                       newUsername);
-                        }
+                                LetsPlayProtocol::encode("username", oldUsername, oldUsername),
+                                command.hdl);
+                        logger.log(user->uuid(),
+                                   " (",
+                                   user->username(),
+                                   ") failed username change to '",
+                                   newUsername,
+                                   "' due to content.");
                     }
+                    break;
                 }
+
+                // Finally, check if username is already taken
+                if (UsernameTaken(newUsername, user->uuid())) {
+                    if (justJoined)
+                        GiveGuest(command.hdl, command.user_hdl);
+                    else {
+                        BroadcastOne(
+                                LetsPlayProtocol::encode("username", oldUsername, oldUsername),
+                                command.hdl);
+                        logger.log(user->uuid(),
+                                   " (",
+                                   user->username(),
+                                   ") failed username change to '",
+                                   newUsername,
+                                   "' because its already taken.");
+                    }
                     break;
-                case kCommandType::List: {
-                    if (!command.params.empty()) break;
+                }
 
-                    if (auto user = command.user_hdl.lock()) {
-                        logger.log(user->uuid(), " (", user->username(), ") requested a user list.");
+                /*
+                 * If all checks were passed, set username and broadcast to the person that they have a new
+                 * username, and send a join/rename to everyone if the person just joined/has been around
+                 */
+                user->setUsername(newUsername);
+                ip.lastRename = std::chrono::steady_clock::now();
+
+                BroadcastOne(
+                        LetsPlayProtocol::encode("username", oldUsername, newUsername),
+                        command.hdl
+                );
+
+                logger.log(user->uuid(), " (", user->username(), ") set username to '", newUsername, '\'');
+
+                if (justJoined) { // Send a join message
+                    BroadcastToEmu(
+                            user->connectedEmu(),
+                            LetsPlayProtocol::encode("join", user->username()),
+                            websocketpp::frame::opcode::text);
+
+                    logger.log(user->uuid(), " (", user->username(), ") joined.");
+                } else { // Tell everyone on the emu someone changed their username
+                    BroadcastToEmu(user->connectedEmu(),
+                                   LetsPlayProtocol::encode("rename", oldUsername, newUsername),
+                                   websocketpp::frame::opcode::text);
+                    logger.log(user->uuid(),
+                               " (",
+                               user->username(),
+                               "): ",
+                               oldUsername,
+                               " is now known as ",
+                               newUsername);
+                }
+            }
+        }
+            break;
+        case kCommandType::List: {
+            if (!command.params.empty()) break;
+
+            if (auto user = command.user_hdl.lock()) {
+                logger.log(user->uuid(), " (", user->username(), ") requested a user list.");
+            }
+
+            std::vector<std::string> message;
+            message.emplace_back("list");
+
+            if (auto commandUser = command.user_hdl.lock()) {
+                std::unique_lock<std::mutex> lkk(m_UsersMutex);
+                auto subscribers = m_Subscribers.find(commandUser->connectedEmu());
+                if (subscribers != m_Subscribers.end()) {
+                    for (auto &pair : subscribers->second) {
+                        if (!pair.first.expired())
+                            message.push_back(pair.second->username());
                     }
+                }
+            }
 
-                    std::vector<std::string> message;
-                    message.emplace_back("list");
+            BroadcastOne(LetsPlayProtocol::encode(message), command.hdl);
+        }
+            break;
+        case kCommandType::Turn: {
+            if (!command.params.empty()) break;
+
+            if (auto user = command.user_hdl.lock()) {
+                logger.log(user->uuid(),
+                           " (",
+                           user->username(),
+                           ") requested a turn."
+                           "user->requestedTurn: ",
+                           (user->requestedTurn) == true,
+                           " user->connectedEmu: ",
+                           user->connectedEmu());
+
+                if (user->connectedEmu().empty() || user->requestedTurn)
+                    break;
 
+                std::unique_lock<std::mutex> lkk(m_EmusMutex);
+                auto search = m_Emus.find(command.emuID);
+                if (search != m_Emus.end() && search->second) {
+                    auto &emu = search->second;
+                    user->requestedTurn = true;
+                    EmuCommand c{kEmuCommandType::TurnRequest, command.user_hdl};
                     {
-                        std::unique_lock<std::mutex> lkk(m_UsersMutex);
-                        for (auto &pair : m_Users) {
-                            auto &hdl = pair.first;
-                            auto &user = pair.second;
-
-                            auto commandUser = command.user_hdl.lock();
-                            if (commandUser) {
-                                if ((commandUser->connectedEmu() == user->connectedEmu()) &&
-                                    !hdl.expired())
-                                    message.push_back(user->username());
-                            }
-                        }
+                        std::unique_lock<std::mutex> lkkk(*(emu->queueMutex));
+                        emu->queue->push(c);
                     }
 
-                    BroadcastOne(LetsPlayProtocol::encode(message), command.hdl);
+                    emu->queueNotifier->notify_one();
                 }
+            }
+        }
+            break;
+        case kCommandType::Shutdown:
+            break;
+        case kCommandType::Connect: {
+            auto user = command.user_hdl.lock();
+            if (user) {
+                if (command.params.size() != 1 || user->username().empty()) {
+                    LetsPlayServer::BroadcastOne(LetsPlayProtocol::encode("connect", false), command.hdl);
+                    logger.log(user->uuid(),
+                               " (",
+                               user->username(),
+                               ") failed to connect to an emulator (1st check).");
                     break;
-                case kCommandType::Turn: {
-                    if (!command.params.empty()) break;
+                }
 
-                    if (auto user = command.user_hdl.lock()) {
+                // Check if the emu that the connect thing that was sent exists
+                {
+                    std::unique_lock<std::mutex> lkk(m_EmusMutex);
+                    if (m_Emus.find(command.params[0]) == m_Emus.end()) {
+                        LetsPlayServer::BroadcastOne(LetsPlayProtocol::encode("connect", false),
+                                                     command.hdl);
                         logger.log(user->uuid(),
                                    " (",
                                    user->username(),
-                                   ") requested a turn."
-                                   "user->requestedTurn: ",
-                                   (user->requestedTurn) == true,
-                                   " user->connectedEmu: ",
-                                   user->connectedEmu());
-
-                        if (user->connectedEmu().empty() || user->requestedTurn)
-                            break;
-
-                        std::unique_lock<std::mutex> lkk(m_EmusMutex);
-                        auto emu = m_Emus[command.emuID];
-                        if (emu) {
-                            user->requestedTurn = true;
-                            EmuCommand c{kEmuCommandType::TurnRequest, command.user_hdl};
-                            {
-                                std::unique_lock<std::mutex> lkkk(*(emu->queueMutex));
-                                emu->queue->push(c);
-                            }
-
-                            emu->queueNotifier->notify_one();
-                        }
+                                   ") tried to connect to an emulator '",
+                                   command.params[0],
+                                   "'that doesn't exist.");
+                        break;
                     }
                 }
-                    break;
-                case kCommandType::Shutdown:
-                    break;
-                case kCommandType::Connect: {
-                    auto user = command.user_hdl.lock();
-                    if (user) {
-                        if (command.params.size() != 1 || user->username().empty()) {
-                            LetsPlayServer::BroadcastOne(LetsPlayProtocol::encode("connect", false), command.hdl);
-                            logger.log(user->uuid(),
-                                       " (",
-                                       user->username(),
-                                       ") failed to connect to an emulator (1st check).");
-                            break;
-                        }
-
-                        // Check if the emu that the connect thing that was sent exists
-                        {
-                            std::unique_lock<std::mutex> lkk(m_EmusMutex);
-                            if (m_Emus.find(command.params[0]) == m_Emus.end()) {
-                                LetsPlayServer::BroadcastOne(LetsPlayProtocol::encode("connect", false),
-                                                             command.hdl);
-                                logger.log(user->uuid(),
-                                           " (",
-                                           user->username(),
-                                           ") tried to connect to an emulator '",
-                                           command.params[0],
-                                           "'that doesn't exist.");
-                                break;
-                            }
-                        }
-
-                        // NOTE: Can remove check and allow on the fly
-                        // switching once the transition between being
-                        // connected to A and being connected to B is
-                        // figured out
-
-                        if (!(user->connectedEmu().empty())) {
-                            logger.log("Tried to switch emus");
-                            break;
-                        }
-
-                        BroadcastToEmu(command.params[0],
-                                       LetsPlayProtocol::encode("join", user->username()),
-                                       websocketpp::frame::opcode::text);
-
-                        user->setConnectedEmu(command.params[0]);
-
-                        BroadcastOne(LetsPlayProtocol::encode("connect", true), command.hdl);
-
-                        logger.log(user->uuid(), " (", user->username(), ") connected to ", command.params[0]);
-
-                        auto maxUsernameLen = config.get<std::uint64_t>(nlohmann::json::value_t::number_unsigned,
-                                                                        "serverConfig", "maxUsernameLength"),
-                                minUsernameLen = config.get<std::uint64_t>(nlohmann::json::value_t::number_unsigned,
-                                                                           "serverConfig", "minUsernameLength"),
-                                maxMessageSize = config.get<std::uint64_t>(nlohmann::json::value_t::number_unsigned,
-                                                                           "serverConfig", "maxMessageSize");
 
-                        BroadcastOne(
-                                LetsPlayProtocol::encode("emuinfo",
-                                                         minUsernameLen,
-                                                         maxUsernameLen,
-                                                         maxMessageSize,
-                                                         user->connectedEmu()),
-                                command.hdl
-                        );
+                // NOTE: Can remove check and allow on the fly
+                // switching once the transition between being
+                // connected to A and being connected to B is
+                // figured out
 
-                        auto &emu = m_Emus[command.params[0]];
+                if (!(user->connectedEmu().empty())) {
+                    logger.log("Tried to switch emus");
+                    break;
+                }
 
-                        EmuCommand c{kEmuCommandType::UserConnect};
+                BroadcastToEmu(command.params[0],
+                               LetsPlayProtocol::encode("join", user->username()),
+                               websocketpp::frame::opcode::text);
 
-                        {
-                            std::unique_lock<std::mutex> lkk(*(emu->queueMutex));
-                            emu->queue->push(c);
-                        }
+                {
+                    std::unique_lock<std::mutex> lkk(m_UsersMutex);
+                    auto search = m_Users.find(command.hdl);
+                    if (search == m_Users.end()) // Left while the command was queued
+                        break;
 
-                        emu->queueNotifier->notify_one();
-                    }
+                    user->setConnectedEmu(command.params[0]);
+                    m_Subscribers[command.params[0]][command.hdl] = search->second;
+                    PublishUsers();
                 }
+
+                BroadcastOne(LetsPlayProtocol::encode("connect", true), command.hdl);
+
+                logger.log(user->uuid(), " (", user->username(), ") connected to ", command.params[0]);
+
+                auto maxUsernameLen = config.get<std::uint64_t>(nlohmann::json::value_t::number_unsigned,
+                                                                "serverConfig", "maxUsernameLength"),
+                        minUsernameLen = config.get<std::uint64_t>(nlohmann::json::value_t::number_unsigned,
+                                                                   "serverConfig", "minUsernameLength"),
+                        maxMessageSize = config.get<std::uint64_t>(nlohmann::json::value_t::number_unsigned,
+                                                                   "serverConfig", "maxMessageSize");
+
+                BroadcastOne(
+                        LetsPlayProtocol::encode("emuinfo",
+                                                 minUsernameLen,
+                                                 maxUsernameLen,
+                                                 maxMessageSize,
+                                                 user->connectedEmu()),
+                        command.hdl
+                );
+
+                std::unique_lock<std::mutex> lkk(m_EmusMutex);
+                auto search = m_Emus.find(command.params[0]);
+                if (search == m_Emus.end())
                     break;
-                case kCommandType::Button: {  // button/leftStick/rightStick, button id, value as int16
-                    if (command.params.size() != 3) break;
 
-                    {
-                        auto user = command.user_hdl.lock();
-                        if (user && !user->hasTurn && !user->hasAdmin) break;
-                    }
+                auto &emu = search->second;
+                EmuCommand c{kEmuCommandType::UserConnect};
 
+                {
+                    std::unique_lock<std::mutex> lkkk(*(emu->queueMutex));
+                    emu->queue->push(c);
+                }
 
-                    const auto &buttonType = command.params[0];
-                    std::int16_t id, value;
+                emu->queueNotifier->notify_one();
+            }
+        }
+            break;
+        case kCommandType::AddEmu: {  // emu, dynamic lib for the core, rom path, emu description
+            // TODO:: Add file path checks
+            if (command.params.size() != 4) break;
 
-                    // Spaghet
-                    {
-                        std::stringstream ss{command.params[1]};
-                        ss >> id;
-                        if (!ss)
-                            break;
-                    }
-                    {
-                        std::stringstream ss{command.params[2]};
-                        ss >> value;
-                        if (!ss)
-                            break;
-                    }
+            if (auto user = command.user_hdl.lock()) {
+                if (!user->hasAdmin)
+                    break;
+            }
 
-                    if (auto user = command.user_hdl.lock())
-                        logger.log(user->uuid(),
-                                   " (",
-                                   user->username(),
-                                   ") sent a '",
-                                   buttonType,
-                                   "' update with id '",
-                                   id,
-                                   "' and value '",
-                                   value,
-                                   '\'');
-
-                    if (id < 0)
-                        break;
+            auto &id = command.params[0];
+            const auto &corePath = command.params[1];
+            const auto &romPath = command.params[2];
+            const auto &description = command.params[3];
 
-                    if (!command.emuID.empty()) {
-                        std::unique_lock<std::mutex> lkk(m_EmusMutex);
-                        auto& joypad = m_Emus[command.emuID]->joypad;
-                        if (buttonType == "button") {
-                            if (id > 15)
-                                break;
-
-                            auto potentialState = joypad->getPressedState();
-                            potentialState[id] = /* isPressed */ std::abs(value) > ((2 << 14) - 1) / 2;
-
-                            bool shouldBlock{false};
-                            for(const auto& forbiddenCombo : *m_Emus[command.emuID]->forbiddenCombos) {
-                                if((potentialState & forbiddenCombo) == forbiddenCombo) {
-                                    shouldBlock = true;
-                                    break;
-                                }
-                            }
-
-                            if(shouldBlock) break;
-
-                            joypad->updateValue(RETRO_DEVICE_INDEX_ANALOG_BUTTON, id, value);
-                        } else if (buttonType == "leftStick") {
-                            if (id > 1)
-                                break;
-                            joypad->updateValue(RETRO_DEVICE_INDEX_ANALOG_LEFT, id, value);
-                        } else if (buttonType == "rightStick") {
-                            if (id > 1)
-                                break;
-                            joypad->updateValue(RETRO_DEVICE_INDEX_ANALOG_RIGHT, id, value);
-                        }
-                    }
-                }
+            {
+                std::unique_lock<std::mutex> lkk(m_EmuThreadMutex);
+                m_EmulatorThreads.emplace_back(
+                        std::thread(EmulatorController::Run, corePath, romPath, this, id, description));
+            }
+
+            PreviewTask();
+        }
+            break;
+        case kCommandType::Admin: {
+            if (command.params.size() != 1) break;
+
+            if (auto user = command.user_hdl.lock()) {
+                std::unique_lock<std::mutex> lkk(m_MutesMutex);
+                auto& ip = m_Mutes[user->IP()];
+                if (ip.adminAttempts >= 3) {
+                    logger.log("Admin attempt from banned user ", user->uuid(), " on ", user->IP());
                     break;
-                case kCommandType::AddEmu: {  // emu, dynamic lib for the core, rom path, emu description
-                    // TODO:: Add file path checks
-                    if (command.params.size() != 4) break;
+                }
+            }
 
-                    if (auto user = command.user_hdl.lock()) {
-                        if (!user->hasAdmin)
-                            break;
-                    }
+            auto salt = config.get<std::string>(nlohmann::json::value_t::string, "serverConfig", "salt"),
+                    expectedHash = config.get<std::string>(nlohmann::json::value_t::string, "serverConfig",
+                                                           "adminHash");
 
-                    auto &id = command.params[0];
-                    const auto &corePath = command.params[1];
-                    const auto &romPath = command.params[2];
-                    const auto &description = command.params[3];
+            std::string hashed = md5(command.params[0] + salt);
 
-                    {
-                        std::unique_lock<std::mutex> lkk(m_EmuThreadMutex);
-                        m_EmulatorThreads.emplace_back(
-                                std::thread(EmulatorController::Run, corePath, romPath, this, id, description));
-                    }
+            if (auto user = command.user_hdl.lock()) {
+                if (hashed == expectedHash) {
+                    user->hasAdmin = true;
+                } else {
+                    std::unique_lock<std::mutex> lkk(m_MutesMutex);
+                    auto& ip = m_Mutes[user->IP()];
+                    ++ip.adminAttempts;
+                    logger.log("Failed admin attempt from ", user->uuid(), "on ", user->IP());
+                }
 
-                    PreviewTask();
+                BroadcastOne(
+                        LetsPlayProtocol::encode("admin", (user->hasAdmin) == true),
+                        command.hdl
+                );
+            }
+        }
+            break;
+        case kCommandType::Pong:
+            if (auto user = command.user_hdl.lock())
+                user->updateLastPong();
+            break;
+        case kCommandType::FastForward: {
+            {
+                auto user = command.user_hdl.lock();
+                if (user && !user->hasTurn && !user->hasAdmin) break;
+            }
+            std::unique_lock<std::mutex> lkk(m_EmusMutex);
+            auto search = m_Emus.find(command.emuID);
+            if (search != m_Emus.end() && search->second) {
+                auto &emu = search->second;
+                EmuCommand c{kEmuCommandType::FastForward};
+                {
+                    std::unique_lock<std::mutex> lkkk(*(emu->queueMutex));
+                    emu->queue->push(c);
                 }
-                    break;
-                case kCommandType::Admin: {
-                    if (command.params.size() != 1) break;
-
-                    if (auto user = command.user_hdl.lock()) {
-                        std::unique_lock<std::mutex> lkk(m_MutesMutex);
-                        auto& ip = m_Mutes[user->IP()];
-                        if (ip.adminAttempts >= 3) {
-                            logger.log("Admin attempt from banned user ", user->uuid(), " on ", user->IP());
-                            break;
-                        }
-                    }
 
-                    auto salt = config.get<std::string>(nlohmann::json::value_t::string, "serverConfig", "salt"),
-                            expectedHash = config.get<std::string>(nlohmann::json::value_t::string, "serverConfig",
-                                                                   "adminHash");
+                emu->queueNotifier->notify_one();
+            }
 
-                    std::string hashed = md5(command.params[0] + salt);
+        }
+            break;
+        case kCommandType::Rewind: {
+            if (command.params.size() != 1) break;
 
-                    if (auto user = command.user_hdl.lock()) {
-                        if (hashed == expectedHash) {
-                            user->hasAdmin = true;
-                        } else {
-                            std::unique_lock<std::mutex> lkk(m_MutesMutex);
-                            auto& ip = m_Mutes[user->IP()];
-                            ++ip.adminAttempts;
-                            logger.log("Failed admin attempt from ", user->uuid(), "on ", user->IP());
-                        }
+            {
+                auto user = command.user_hdl.lock();
+                if (!user || !user->hasAdmin) break;
+            }
 
-                        BroadcastOne(
-                                LetsPlayProtocol::encode("admin", (user->hasAdmin) == true),
-                                command.hdl
-                        );
-                    }
-                }
-                    break;
-                case kCommandType::Pong:
-                    if (auto user = command.user_hdl.lock())
-                        user->updateLastPong();
+            std::uint64_t seconds;
+            {
+                std::stringstream ss{command.params[0]};
+                ss >> seconds;
+                if (!ss)
                     break;
-                case kCommandType::FastForward: {
-                    {
-                        auto user = command.user_hdl.lock();
-                        if (user && !user->hasTurn && !user->hasAdmin) break;
-                    }
-                    std::unique_lock<std::mutex> lkk(m_EmusMutex);
-                    auto emu = m_Emus[command.emuID];
-                    if (emu) {
-                        EmuCommand c{kEmuCommandType::FastForward};
-                        {
-                            std::unique_lock<std::mutex> lkkk(*(emu->queueMutex));
-                            emu->queue->push(c);
-                        }
-
-                        emu->queueNotifier->notify_one();
-                    }
+            }
 
+            std::unique_lock<std::mutex> lkk(m_EmusMutex);
+            auto search = m_Emus.find(command.emuID);
+            if (search != m_Emus.end() && search->second) {
+                auto &emu = search->second;
+                EmuCommand c{kEmuCommandType::Rewind, boost::none, seconds};
+                {
+                    std::unique_lock<std::mutex> lkkk(*(emu->queueMutex));
+                    emu->queue->push(c);
                 }
-                    break;
-                case kCommandType::Preview: {
-                    std::unique_lock<std::mutex> lkk(m_PreviewsMutex);
-                    for (const auto &preview : m_Previews) {
-                        websocketpp::lib::error_code ec;
-                        server->send(command.hdl, preview.second.data(), preview.second.size(),
-                                     websocketpp::frame::opcode::binary, ec);
-                    }
-                }
-                case kCommandType::RemoveEmu:
-                case kCommandType::StopEmu:
-                case kCommandType::Config:
-                case kCommandType::Unknown:
-                    // Unimplemented
-                    break;
-                default:
-                    break;
+
+                emu->queueNotifier->notify_one();
             }
-            m_WorkQueue.pop();
         }
+            break;
+        case kCommandType::Preview: {
+            std::unique_lock<std::mutex> lkk(m_PreviewsMutex);
+            for (const auto &preview : m_Previews) {
+                websocketpp::lib::error_code ec;
+                server->send(command.hdl, preview.second.data(), preview.second.size(),
+                             websocketpp::frame::opcode::binary, ec);
+            }
+        }
+        case kCommandType::RemoveEmu:
+        case kCommandType::StopEmu:
+        case kCommandType::Config:
+        case kCommandType::Unknown:
+            // Unimplemented
+            break;
+        default:
+            break;
+    }
+}
+
+void LetsPlayServer::LaneTask() {
+    for (const auto &stats : m_Lanes.TakeStats()) {
+        if (stats.handled == 0 && stats.depth == 0)
+            continue;
+
+        using std::chrono::microseconds;
+        logger.log("Commands for ", stats.lane.empty() ? "the server" : stats.lane, ": ", stats.handled,
+                   " handled, ", stats.depth, " queued (at most ", stats.maxDepth, "), took ",
+                   std::chrono::duration_cast<microseconds>(stats.averageLatency).count(), "us on average (max ",
+                   std::chrono::duration_cast<microseconds>(stats.maxLatency).count(), "us).");
     }
 }
 
 void LetsPlayServer::GeneratePreview(const EmuID_t &id) {
-    auto index = std::distance(m_Emus.begin(), m_Emus.find(id));
+    std::ptrdiff_t index;
+    {
+        std::unique_lock<std::mutex> lk(m_EmusMutex);
+        index = std::distance(m_Emus.begin(), m_Emus.find(id));
+    }
+
     auto jpegData = GenerateEmuJPEG(id);
 
     // Set binary payload info
     jpegData[0] = index | (kBinaryMessageType::Preview << 5);
 
+    std::unique_lock<std::mutex> lk(m_PreviewsMutex);
     m_Previews[id] = jpegData;
 }
 
 void LetsPlayServer::PingTask() {
-    for (auto &pair : m_Users) {
+    static const std::string ping = LetsPlayProtocol::encode("ping");
+
+    const auto registry = std::atomic_load(&m_Registry);
+    for (auto &pair : registry->users) {
         auto &hdl = pair.first;
         auto &user = pair.second;
         websocketpp::lib::error_code ec;
@@ -1007,7 +1232,7 @@ void LetsPlayServer::PingTask() {
 
         // Send a ping if not
         if (!hdl.expired())
-            server->send(hdl, LetsPlayProtocol::encode("ping"), websocketpp::frame::opcode::text);
+            server->send(hdl, ping, websocketpp::frame::opcode::text, ec);
     }
 }
 
@@ -1029,15 +1254,39 @@ void LetsPlayServer::PreviewTask() {
     }
 }
 
+wcpp_server::message_ptr LetsPlayServer::PrepareMessage(const void *data, size_t size,
+                                                        websocketpp::frame::opcode::value op) {
+    using config = websocketpp::config::asio;
+
+    // Same processor a connection uses, on the server side (unmasked, no extensions)
+    static thread_local auto manager = std::make_shared<config::con_msg_manager_type>();
+    static thread_local config::rng_type rng;
+    static thread_local websocketpp::processor::hybi13<config> processor(false, true, manager, rng);
+
+    auto message = manager->get_message(op, size);
+    message->append_payload(data, size);
+
+    auto prepared = manager->get_message();
+    if (processor.prepare_data_frame(message, prepared))
+        return nullptr;
+
+    return prepared;
+}
+
 void LetsPlayServer::BroadcastAll(const std::string& data, websocketpp::frame::opcode::value op) {
-    std::unique_lock<std::mutex> lk(m_UsersMutex, std::try_to_lock);
-    for (auto &pair : m_Users) {
+    const auto registry = std::atomic_load(&m_Registry);
+
+    const auto message = PrepareMessage(data.data(), data.size(), op);
+    if (!message)
+        return;
+
+    for (auto &pair : registry->users) {
         auto &hdl = pair.first;
         auto &user = pair.second;
 
         websocketpp::lib::error_code ec;
-        if (!user->username().empty() && user->connected && !hdl.expired())
-            server->send(hdl, data, op, ec);
+        if (user->connected && user->hasUsername() && !hdl.expired())
+            server->send(hdl, message, ec);
     }
 }
 
@@ -1048,18 +1297,35 @@ void LetsPlayServer::BroadcastOne(const std::string&& data, websocketpp::connect
 
 void LetsPlayServer::BroadcastToEmu(const EmuID_t& id, const std::string& message,
                                     websocketpp::frame::opcode::value op) {
-    std::unique_lock<std::mutex> lk(m_UsersMutex, std::try_to_lock);
-    for (auto &pair : m_Users) {
+    const auto registry = std::atomic_load(&m_Registry);
+    auto subscribers = registry->subscribers.find(id);
+    if (subscribers == registry->subscribers.end() || subscribers->second.empty())
+        return;
+
+    const auto prepared = PrepareMessage(message.data(), message.size(), op);
+    if (!prepared)
+        return;
+
+    for (auto &pair : subscribers->second) {
         auto &hdl = pair.first;
         auto &user = pair.second;
 
         websocketpp::lib::error_code ec;
-        if (user->connectedEmu() == id && !user->username().empty() && user->connected
-            && !hdl.expired())
-            server->send(hdl, message, op, ec);
+        if (user->connected && user->hasUsername() && !hdl.expired())
+            server->send(hdl, prepared, ec);
     }
 }
 
+void LetsPlayServer::PublishUsers() {
+    auto registry = std::make_shared<UserRegistry>();
+
+    registry->users.assign(m_Users.begin(), m_Users.end());
+    for (const auto &emu : m_Subscribers)
+        registry->subscribers[emu.first].assign(emu.second.begin(), emu.second.end());
+
+    std::atomic_store(&m_Registry, std::shared_ptr<const UserRegistry>(std::move(registry)));
+}
+
 void LetsPlayServer::GiveGuest(websocketpp::connection_hdl hdl, LetsPlayUserHdl user_hdl) {
     // TODO: Custom guest usernames? (i.e. being able to specify player##### in config)
     if (auto user = user_hdl.lock()) {
@@ -1137,15 +1403,28 @@ void LetsPlayServer::SetupLetsPlayDirectories() {
     boost::filesystem::create_directories(emuDirectory = dataPath / "emulators");
     boost::filesystem::create_directories(romDirectory = dataPath / "roms");
     boost::filesystem::create_directories(coreDirectory = dataPath / "cores");
+    boost::filesystem::create_directories(cacheDirectory = dataPath / "cache");
 }
 
 void LetsPlayServer::SaveTask() {
-    std::unique_lock<std::mutex> lk(m_EmusMutex);
+    const auto lag = ioWorker.TakeMaxLag();
+    if (lag.count())
+        logger.log("Longest IO queue wait since the last save: ", lag.count(), "ms.");
 
-    for (auto &p : m_Emus) {
-        auto &emu = p.second;
+    StaggerEmuCommand(kEmuCommandType::Save, std::chrono::minutes(
+            config.get<std::uint64_t>(nlohmann::json::value_t::number_unsigned, "serverConfig", "backups",
+                                      "historyInterval")));
+}
+
+void LetsPlayServer::BackupTask() {
+    StaggerEmuCommand(kEmuCommandType::Backup, std::chrono::minutes(
+            config.get<std::uint64_t>(nlohmann::json::value_t::number_unsigned, "serverConfig", "backups",
+                                      "backupInterval")));
+}
 
-        EmuCommand c{kEmuCommandType::Save};
+void LetsPlayServer::StaggerEmuCommand(kEmuCommandType type, std::chrono::milliseconds period) {
+    auto push = [](EmulatorControllerProxy *emu, kEmuCommandType type) {
+        EmuCommand c{type};
 
         {
             std::unique_lock<std::mutex> lkk(*(emu->queueMutex));
@@ -1153,23 +1432,45 @@ void LetsPlayServer::SaveTask() {
         }
 
         emu->queueNotifier->notify_one();
+    };
+
+    if (!config.get<bool>(nlohmann::json::value_t::boolean, "serverConfig", "backups", "stagger")) {
+        std::unique_lock<std::mutex> lk(m_EmusMutex);
+        for (auto &p : m_Emus)
+            push(p.second, type);
+        return;
     }
-}
 
-void LetsPlayServer::BackupTask() {
-    std::unique_lock<std::mutex> lk(m_EmusMutex);
+    std::vector<EmuID_t> ids;
+    {
+        std::unique_lock<std::mutex> lk(m_EmusMutex);
+        for (auto &p : m_Emus)
+            ids.push_back(p.first);
+    }
 
-    for (auto &p : m_Emus) {
-        auto &emu = p.second;
+    if (ids.empty())
+        return;
+
+    // Each emulator gets an equal slice of three quarters of the period and a random point in it, so the round is
+    // done before the next one starts
+    const auto slice = period * 3 / 4 / ids.size();
+    const auto start = std::chrono::steady_clock::now();
 
-        EmuCommand c{kEmuCommandType::Backup};
+    for (size_t i = 0; i < ids.size(); ++i) {
+        const auto jitter = slice * (rnd::nextInt() % 1000) / 1000;
+        const auto when = start + slice * i + jitter;
 
         {
-            std::unique_lock<std::mutex> lkk(*(emu->queueMutex));
-            emu->queue->push(c);
+            std::unique_lock<std::mutex> lk(m_StaggerMutex);
+            if (m_StaggerNotifier.wait_until(lk, when, [&]() { return !m_Running; }))
+                return;
         }
 
-        emu->queueNotifier->notify_one();
+        // The emulator might have been removed while waiting
+        std::unique_lock<std::mutex> lk(m_EmusMutex);
+        auto emu = m_Emus.find(ids[i]);
+        if (emu != m_Emus.end())
+            push(emu->second, type);
     }
 }
 
@@ -1192,17 +1493,28 @@ size_t LetsPlayServer::escapedSize(const std::string& str) {
 }
 
 std::vector<std::uint8_t> LetsPlayServer::GenerateEmuJPEG(const EmuID_t &id) {
+    Frame frame = [&]() {
+        EmulatorControllerProxy *emu{nullptr};
+        {
+            std::unique_lock<std::mutex> lk(m_EmusMutex);
+            auto search = m_Emus.find(id);
+            if (search != m_Emus.end())
+                emu = search->second;
+        }
+
+        return emu ? emu->getFrame() : Frame{0, 0, 0, nullptr};
+    }();
+
+    return EncodeJPEG(frame);
+}
+
+std::vector<std::uint8_t> LetsPlayServer::EncodeJPEG(const Frame &frame) {
     thread_local static tjhandle _jpegCompressor = tjInitCompress();
     thread_local static long unsigned int _jpegBufferSize = 20000000;
     thread_local static std::vector<std::uint8_t> jpegData(20000000); // 20MB jpeg buffer
     thread_local static unsigned i{0};
     thread_local static auto quality = config.get<std::uint64_t>(nlohmann::json::value_t::number_unsigned,
                                                                  "serverConfig", "jpegQuality");
-    Frame frame = [&]() {
-        // Possible race condition, unlocked m_EmusMutex
-        auto emu = m_Emus[id];
-        return emu->getFrame();
-    }();
 
     // currentBuffer was nullptr
     if (frame.width == 0 || frame.height == 0) return std::vector<std::uint8_t>{0, 2};
@@ -1231,14 +1543,24 @@ void LetsPlayServer::SendFrame(const EmuID_t& id) {
     // Mark as screen message
     jpegData[0] = 0 | (kBinaryMessageType::Screen << 5);
 
-    std::unique_lock<std::mutex> lk(m_UsersMutex);
-    for (auto &pair : m_Users) {
+    // Sending can take a while, so this works off a snapshot rather than holding m_UsersMutex
+    const auto registry = std::atomic_load(&m_Registry);
+    auto subscribers = registry->subscribers.find(id);
+    if (subscribers == registry->subscribers.end() || subscribers->second.empty())
+        return;
+
+    // Framed once and shared, instead of every connection copying and framing its own
+    const auto message = PrepareMessage(jpegData.data(), jpegData.size(), websocketpp::frame::opcode::binary);
+    if (!message)
+        return;
+
+    for (auto &pair : subscribers->second) {
         auto &hdl = pair.first;
         auto &user = pair.second;
 
-        if (user->connectedEmu() == id && user->connected && !hdl.expired()) {
+        if (user->connected && !hdl.expired()) {
             websocketpp::lib::error_code ec;
-            server->send(hdl, jpegData.data(), jpegData.size(), websocketpp::frame::opcode::binary, ec);
+            server->send(hdl, message, ec);
         }
     }
 }
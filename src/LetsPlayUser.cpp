@@ -19,6 +19,7 @@ LetsPlayUser::LetsPlayUser()
 }
 
 bool LetsPlayUser::shouldDisconnect() {
+    std::unique_lock<std::mutex> lk(m_access);
     return std::chrono::steady_clock::now() >
         (m_lastPong + std::chrono::seconds(10));
 }
@@ -48,6 +49,11 @@ void LetsPlayUser::setUsername(const std::string& name) {
     m_username = name;
 }
 
+bool LetsPlayUser::hasUsername() {
+    std::unique_lock<std::mutex> lk(m_access);
+    return !m_username.empty();
+}
+
 std::string LetsPlayUser::IP() const {
     return m_ip;
 }
@@ -5,6 +5,7 @@
 
 #include <boost/program_options.hpp>
 
+#include "Benchmark.h"
 #include "EmulatorController.h"
 #include "LetsPlayServer.h"
 #include "RetroCore.h"
@@ -12,6 +13,10 @@
 int main(int argc, char **argv) {
     std::uint16_t port{8080};
 
+    bool benchmark{false};
+    BenchmarkOptions benchmarkOptions;
+    ProtocolBenchmarkOptions protocolBenchmarkOptions;
+
     boost::filesystem::path configPath; // default: ($XDG_CONFIG_HOME || $HOME/.config)/letsplay/config.json
     const char *cXDGConfigHome = std::getenv("XDG_CONFIG_HOME");
     if (cXDGConfigHome)
@@ -32,6 +37,23 @@ int main(int argc, char **argv) {
         desc.add_options()("help,h", "Help")
             ("config", program_options::value<std::string>(), "Config file path")
             ("port", program_options::value<std::uint16_t>(), "Port to run the server on");
+
+        program_options::options_description benchmarkDesc{"Benchmark options"};
+        benchmarkDesc.add_options()("benchmark", "Run a core unthrottled without the server and report performance")
+            ("core", program_options::value<std::string>(), "Core to benchmark")
+            ("rom", program_options::value<std::string>(), "Rom to benchmark (optional)")
+            ("replay", program_options::value<std::string>(), "Input movie to replay (optional)")
+            ("frames", program_options::value<std::uint64_t>()->default_value(3600), "Frames to run")
+            ("convert", "Convert frames to XRGB8888")
+            ("encode", "Encode frames as jpeg (implies --convert)")
+            ("sinks", program_options::value<std::uint64_t>()->default_value(0), "Mock websocket connections to send encoded frames to")
+            ("rewind", "Capture rewind states like the emulator template does")
+            ("record-input", "Record an input movie")
+            ("run-ahead", program_options::value<std::uint64_t>()->default_value(0), "Frames to run ahead")
+            ("second-instance", "Run ahead using a second instance of the core")
+            ("benchmark-protocol", program_options::value<std::string>(), "Decode a traffic capture (or server log) and report time per message")
+            ("iterations", program_options::value<std::uint64_t>()->default_value(100), "Times to decode the capture");
+        desc.add(benchmarkDesc);
         // clang-format on
 
         program_options::variables_map vm;
@@ -50,6 +72,34 @@ int main(int argc, char **argv) {
             configPath = LetsPlayServer::escapeTilde(vm["config"].as<std::string>());
         }
 
+        if (vm.count("benchmark-protocol")) {
+            protocolBenchmarkOptions.capturePath = LetsPlayServer::escapeTilde(vm["benchmark-protocol"].as<std::string>());
+            protocolBenchmarkOptions.iterations = vm["iterations"].as<std::uint64_t>();
+            return BenchmarkProtocol(protocolBenchmarkOptions);
+        }
+
+        if (vm.count("benchmark")) {
+            if (!vm.count("core")) {
+                std::cerr << "--benchmark requires --core" << '\n';
+                return 1;
+            }
+
+            benchmark = true;
+            benchmarkOptions.corePath = LetsPlayServer::escapeTilde(vm["core"].as<std::string>());
+            if (vm.count("rom"))
+                benchmarkOptions.romPath = LetsPlayServer::escapeTilde(vm["rom"].as<std::string>());
+            if (vm.count("replay"))
+                benchmarkOptions.replayPath = LetsPlayServer::escapeTilde(vm["replay"].as<std::string>());
+            benchmarkOptions.frames = vm["frames"].as<std::uint64_t>();
+            benchmarkOptions.convert = vm.count("convert") > 0;
+            benchmarkOptions.encode = vm.count("encode") > 0;
+            benchmarkOptions.sinks = vm["sinks"].as<std::uint64_t>();
+            benchmarkOptions.rewind = vm.count("rewind") > 0;
+            benchmarkOptions.recordInput = vm.count("record-input") > 0;
+            benchmarkOptions.runAheadFrames = vm["run-ahead"].as<std::uint64_t>();
+            benchmarkOptions.runAheadSecondInstance = vm.count("second-instance") > 0;
+        }
+
         if (boost::filesystem::create_directories(configPath.parent_path()))
             std::cerr << "Warning: Config file didn't initially exist. Creating directories." << '\n';
 
@@ -58,6 +108,13 @@ int main(int argc, char **argv) {
     }
     LetsPlayServer server(configPath);
 
+    if (benchmark) {
+        server.SetupLetsPlayDirectories();
+        const int result = EmulatorController::Benchmark(benchmarkOptions, &server);
+        server.scheduler.Stop();
+        return result;
+    }
+
     bool retry{true};
     while (retry) {
         try {
@@ -0,0 +1,319 @@
+/**
+ * Deterministic libretro core used as a standard workload for benchmarks and load tests. Doesn't need a rom.
+ *
+ * Configured through core options (config["coreConfig"]["MockCore"] in Let's Play):
+ *      mockcore_scene          static | scroll | noise
+ *      mockcore_pixel_format   0rgb1555 | rgb565 | xrgb8888
+ *      mockcore_width          Width in px
+ *      mockcore_height         Height in px
+ *      mockcore_tone_hz        Frequency of the generated sine tone, 0 for silence
+ *      mockcore_state_size     Size of the serialized state in bytes
+ *
+ * Everything the core outputs is a function of the frame number and the input it was given, so two runs with the
+ * same input produce the same frames, audio and states.
+ */
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "libretro.h"
+
+namespace {
+    enum class kScene {
+        Static,
+        Scroll,
+        Noise,
+    };
+
+    /**
+     * Part of the state that actually changes, serialized at the start of the state
+     */
+    struct MockState {
+        std::uint64_t frame{0};
+        std::uint32_t rng{0x12345678};
+        std::uint32_t inputHash{0};
+        std::uint32_t tonePhase{0};
+        std::uint32_t pressed{0};
+    };
+
+    constexpr unsigned sampleRate{48000};
+    constexpr double fps{60.0};
+    constexpr unsigned samplesPerFrame = static_cast<unsigned>(sampleRate / fps);
+
+    retro_environment_t environ_cb{nullptr};
+    retro_video_refresh_t video_cb{nullptr};
+    retro_input_poll_t input_poll_cb{nullptr};
+    retro_input_state_t input_state_cb{nullptr};
+    retro_audio_sample_t audio_cb{nullptr};
+    retro_audio_sample_batch_t audio_batch_cb{nullptr};
+
+    kScene scene{kScene::Scroll};
+    retro_pixel_format pixelFormat{RETRO_PIXEL_FORMAT_RGB565};
+    unsigned width{256}, height{224};
+    unsigned toneHz{440};
+    size_t stateSize{65536};
+
+    bool loaded{false};
+    MockState state;
+
+    std::vector<std::uint8_t> framebuffer;
+    std::vector<std::int16_t> audio(samplesPerFrame * 2);
+
+    std::string variable(const char *key, const char *fallback) {
+        retro_variable var{key, nullptr};
+        if (environ_cb && environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE, &var) && var.value)
+            return var.value;
+        return fallback;
+    }
+
+    unsigned variableNumber(const char *key, unsigned fallback) {
+        const auto value = variable(key, "");
+        if (value.empty())
+            return fallback;
+        return static_cast<unsigned>(std::strtoul(value.c_str(), nullptr, 10));
+    }
+
+    unsigned bytesPerPixel() {
+        return pixelFormat == RETRO_PIXEL_FORMAT_XRGB8888 ? 4 : 2;
+    }
+
+    std::uint32_t xorshift(std::uint32_t &x) {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        return x;
+    }
+
+    /**
+     * Packs an 8 bit per channel color into the current pixel format
+     */
+    std::uint32_t pack(std::uint8_t r, std::uint8_t g, std::uint8_t b) {
+        switch (pixelFormat) {
+            case RETRO_PIXEL_FORMAT_XRGB8888:
+                return (r << 16) | (g << 8) | b;
+            case RETRO_PIXEL_FORMAT_RGB565:
+                return ((r >> 3) << 11) | ((g >> 2) << 5) | (b >> 3);
+            default: // 0RGB1555
+                return ((r >> 3) << 10) | ((g >> 3) << 5) | (b >> 3);
+        }
+    }
+
+    void putPixel(std::uint8_t *row, unsigned x, std::uint32_t color) {
+        if (bytesPerPixel() == 4) {
+            std::memcpy(row + x * 4, &color, 4);
+        } else {
+            const auto color16 = static_cast<std::uint16_t>(color);
+            std::memcpy(row + x * 2, &color16, 2);
+        }
+    }
+
+    void configure() {
+        const auto sceneName = variable("mockcore_scene", "scroll");
+        if (sceneName == "static")
+            scene = kScene::Static;
+        else if (sceneName == "noise")
+            scene = kScene::Noise;
+        else
+            scene = kScene::Scroll;
+
+        const auto formatName = variable("mockcore_pixel_format", "rgb565");
+        if (formatName == "xrgb8888")
+            pixelFormat = RETRO_PIXEL_FORMAT_XRGB8888;
+        else if (formatName == "0rgb1555")
+            pixelFormat = RETRO_PIXEL_FORMAT_0RGB1555;
+        else
+            pixelFormat = RETRO_PIXEL_FORMAT_RGB565;
+
+        width = std::max(16u, std::min(variableNumber("mockcore_width", 256), 4096u));
+        height = std::max(16u, std::min(variableNumber("mockcore_height", 224), 4096u));
+        toneHz = std::min(variableNumber("mockcore_tone_hz", 440), sampleRate / 2);
+        stateSize = std::max<size_t>(variableNumber("mockcore_state_size", 65536), sizeof(MockState));
+
+        if (!environ_cb || !environ_cb(RETRO_ENVIRONMENT_SET_PIXEL_FORMAT, &pixelFormat))
+            pixelFormat = RETRO_PIXEL_FORMAT_0RGB1555;
+
+        // Padded so that frontends converting 16 pixels at a time can't read off the end
+        framebuffer.assign(width * height * bytesPerPixel() + 64, 0);
+    }
+
+    void drawFrame() {
+        const unsigned pitch = width * bytesPerPixel();
+        const unsigned offset = scene == kScene::Scroll ? static_cast<unsigned>(state.frame) : 0;
+
+        for (unsigned y = 0; y < height; ++y) {
+            std::uint8_t *row = framebuffer.data() + y * pitch;
+            for (unsigned x = 0; x < width; ++x) {
+                std::uint32_t color;
+                if (scene == kScene::Noise) {
+                    const auto n = xorshift(state.rng);
+                    color = pack(n, n >> 8, n >> 16);
+                } else {
+                    // Color bars with a checkerboard over them
+                    const unsigned bar = ((x + offset) * 8 / width) % 8;
+                    const bool checker = (((x + offset) / 16) + ((y + offset / 2) / 16)) & 1;
+                    const std::uint8_t level = checker ? 0xFF : 0xC0;
+                    color = pack(bar & 1 ? level : 0, bar & 2 ? level : 0, bar & 4 ? level : 0);
+                }
+                putPixel(row, x, color);
+            }
+        }
+
+        // Strip along the top showing the pressed buttons, so that replays can be checked by eye
+        for (unsigned x = 0; x < std::min(width, 16u * 8); ++x) {
+            const bool pressed = (state.pressed >> (x / 8)) & 1;
+            putPixel(framebuffer.data(), x, pressed ? pack(0xFF, 0xFF, 0xFF) : pack(0x20, 0x20, 0x20));
+        }
+    }
+
+    void generateAudio() {
+        static const double tau = 6.283185307179586;
+
+        for (unsigned i = 0; i < samplesPerFrame; ++i) {
+            std::int16_t sample{0};
+            if (toneHz) {
+                sample = static_cast<std::int16_t>(std::sin(tau * state.tonePhase / sampleRate) * 8000);
+                state.tonePhase = (state.tonePhase + toneHz) % sampleRate;
+            }
+            audio[i * 2] = audio[i * 2 + 1] = sample;
+        }
+
+        if (audio_batch_cb)
+            audio_batch_cb(audio.data(), samplesPerFrame);
+    }
+
+    /**
+     * Filler byte for the part of the state after MockState. Mostly static with a region that changes every frame,
+     * like a real core's RAM.
+     */
+    std::uint8_t filler(size_t i) {
+        const size_t hot = (stateSize - sizeof(MockState)) / 16;
+        if (i < hot)
+            return static_cast<std::uint8_t>((i * 31) ^ state.frame ^ state.inputHash);
+        return static_cast<std::uint8_t>(i * 31);
+    }
+}
+
+RETRO_API void retro_set_environment(retro_environment_t cb) {
+    environ_cb = cb;
+
+    bool noGame = true;
+    cb(RETRO_ENVIRONMENT_SET_SUPPORT_NO_GAME, &noGame);
+}
+
+RETRO_API void retro_set_video_refresh(retro_video_refresh_t cb) { video_cb = cb; }
+
+RETRO_API void retro_set_audio_sample(retro_audio_sample_t cb) { audio_cb = cb; }
+
+RETRO_API void retro_set_audio_sample_batch(retro_audio_sample_batch_t cb) { audio_batch_cb = cb; }
+
+RETRO_API void retro_set_input_poll(retro_input_poll_t cb) { input_poll_cb = cb; }
+
+RETRO_API void retro_set_input_state(retro_input_state_t cb) { input_state_cb = cb; }
+
+RETRO_API void retro_init() {
+    state = MockState{};
+    loaded = false;
+}
+
+RETRO_API void retro_deinit() {
+    framebuffer.clear();
+    loaded = false;
+}
+
+RETRO_API unsigned retro_api_version() { return RETRO_API_VERSION; }
+
+RETRO_API void retro_get_system_info(retro_system_info *info) {
+    std::memset(info, 0, sizeof(*info));
+    info->library_name = "MockCore";
+    info->library_version = "1.0";
+    info->valid_extensions = "";
+    info->need_fullpath = false;
+    info->block_extract = false;
+}
+
+RETRO_API void retro_get_system_av_info(retro_system_av_info *info) {
+    std::memset(info, 0, sizeof(*info));
+    info->geometry.base_width = info->geometry.max_width = width;
+    info->geometry.base_height = info->geometry.max_height = height;
+    info->geometry.aspect_ratio = static_cast<float>(width) / height;
+    info->timing.fps = fps;
+    info->timing.sample_rate = sampleRate;
+}
+
+RETRO_API void retro_set_controller_port_device(unsigned, unsigned) {}
+
+RETRO_API void retro_reset() { state = MockState{}; }
+
+RETRO_API void retro_run() {
+    // Frontends that don't call retro_load_game for no-game cores still get a picture
+    if (!loaded) {
+        configure();
+        loaded = true;
+    }
+
+    if (input_poll_cb)
+        input_poll_cb();
+
+    state.pressed = 0;
+    if (input_state_cb) {
+        for (unsigned id = 0; id < 16; ++id) {
+            if (input_state_cb(0, RETRO_DEVICE_JOYPAD, 0, id))
+                state.pressed |= 1u << id;
+        }
+    }
+    state.inputHash = (state.inputHash * 31) ^ state.pressed;
+
+    drawFrame();
+    generateAudio();
+
+    if (video_cb)
+        video_cb(framebuffer.data(), width, height, width * bytesPerPixel());
+
+    ++state.frame;
+}
+
+RETRO_API size_t retro_serialize_size() { return stateSize; }
+
+RETRO_API bool retro_serialize(void *data, size_t size) {
+    if (size < stateSize)
+        return false;
+
+    auto *out = static_cast<std::uint8_t *>(data);
+    std::memcpy(out, &state, sizeof(MockState));
+    for (size_t i = sizeof(MockState); i < stateSize; ++i)
+        out[i] = filler(i - sizeof(MockState));
+
+    return true;
+}
+
+RETRO_API bool retro_unserialize(const void *data, size_t size) {
+    if (size < sizeof(MockState))
+        return false;
+
+    std::memcpy(&state, data, sizeof(MockState));
+    return true;
+}
+
+RETRO_API void retro_cheat_reset() {}
+
+RETRO_API void retro_cheat_set(unsigned, bool, const char *) {}
+
+RETRO_API bool retro_load_game(const retro_game_info *) {
+    configure();
+    loaded = true;
+    return true;
+}
+
+RETRO_API bool retro_load_game_special(unsigned, const retro_game_info *, size_t) { return false; }
+
+RETRO_API void retro_unload_game() { loaded = false; }
+
+RETRO_API unsigned retro_get_region() { return RETRO_REGION_NTSC; }
+
+RETRO_API void *retro_get_memory_data(unsigned) { return nullptr; }
+
+RETRO_API size_t retro_get_memory_size(unsigned) { return 0; }
@@ -0,0 +1,171 @@
+#include "Benchmark.h"
+
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "LetsPlayProtocol.h"
+
+namespace {
+/**
+ * Reads the messages out of a capture, see ProtocolBenchmarkOptions::capturePath
+ */
+std::vector<std::string> ReadCapture(const std::string &path) {
+    std::vector<std::string> messages;
+
+    std::ifstream in(path, std::ios::binary);
+    std::string line;
+    while (std::getline(in, line)) {
+        const auto raw = line.find("raw: '");
+        if (raw != std::string::npos) {
+            const auto start = raw + 6, end = line.rfind('\'');
+            if (end > start)
+                messages.push_back(line.substr(start, end - start));
+        } else if (!line.empty() && line.back() == ';') {
+            messages.push_back(line);
+        }
+    }
+
+    return messages;
+}
+
+/**
+ * The istringstream decoder LetsPlayProtocol used before it decoded into views, kept as it was (apart from not
+ * reading past an empty input) so the current decoder can be checked and timed against it
+ */
+std::vector<std::string> ReferenceDecode(const std::string &input) {
+    std::vector<std::string> output;
+
+    if (input.empty() || input.back() != ';') return output;
+
+    std::istringstream iss{input};
+    while (iss) {
+        unsigned long long length{0};
+        iss >> length;
+
+        if (!iss || length >= 1'000) {
+            return std::vector<std::string>();
+        }
+
+        if (iss.peek() != '.') return std::vector<std::string>();
+
+        iss.get();  // remove the period
+
+        std::vector<char> content(length + 1, '\0');
+        iss.read(content.data(), static_cast<std::streamsize>(length));
+        output.push_back(std::string(content.data()));
+
+        const char &separator = iss.peek();
+        if (separator != ',') {
+            if (separator == ';') return output;
+
+            return std::vector<std::string>();
+        }
+
+        iss.get();
+    }
+    return std::vector<std::string>();
+}
+}
+
+int BenchmarkProtocol(const ProtocolBenchmarkOptions &options) {
+    const auto messages = ReadCapture(options.capturePath);
+    if (messages.empty()) {
+        std::cerr << "No messages found in " << options.capturePath << '\n';
+        return 1;
+    }
+
+    using clock = std::chrono::steady_clock;
+
+    // The decoders have to agree with the reference for the timings to mean anything
+    std::uint64_t mismatches{0}, invalid{0};
+    for (const auto &message : messages) {
+        const auto reference = ReferenceDecode(message);
+
+        LetsPlayProtocol::Chunks chunks;
+        const auto count = LetsPlayProtocol::decode(message, chunks, 999);
+
+        bool same = count == reference.size() && LetsPlayProtocol::decode(message) == reference;
+        for (size_t i = 0; same && i < count; ++i)
+            same = chunks[i] == reference[i];
+
+        if (!same && mismatches++ < 10)
+            std::cerr << "Decoded differently: '" << message << "'\n";
+
+        invalid += reference.empty();
+    }
+
+    // Summed so that the decoding can't be optimized away
+    std::uint64_t checksum{0};
+
+    auto start = clock::now();
+    for (std::uint64_t i = 0; i < options.iterations; ++i) {
+        for (const auto &message : messages) {
+            const auto decoded = ReferenceDecode(message);
+            for (const auto &chunk : decoded)
+                checksum += chunk.size();
+        }
+    }
+    const auto referenceTime = clock::now() - start;
+
+    start = clock::now();
+    for (std::uint64_t i = 0; i < options.iterations; ++i) {
+        for (const auto &message : messages) {
+            const auto decoded = LetsPlayProtocol::decode(message);
+            for (const auto &chunk : decoded)
+                checksum += chunk.size();
+        }
+    }
+    const auto vectorTime = clock::now() - start;
+
+    start = clock::now();
+    for (std::uint64_t i = 0; i < options.iterations; ++i) {
+        for (const auto &message : messages) {
+            LetsPlayProtocol::Chunks chunks;
+            const auto count = LetsPlayProtocol::decode(message, chunks, 999);
+            for (size_t j = 0; j < count; ++j)
+                checksum += chunks[j].size();
+        }
+    }
+    const auto viewTime = clock::now() - start;
+
+    // Encode the same messages back, as the server does with what it sends
+    std::vector<std::vector<std::string>> decodedMessages;
+    for (const auto &message : messages) {
+        auto decoded = LetsPlayProtocol::decode(message);
+        if (!decoded.empty())
+            decodedMessages.push_back(std::move(decoded));
+    }
+
+    std::string encoded;
+    start = clock::now();
+    for (std::uint64_t i = 0; i < options.iterations; ++i) {
+        for (const auto &decoded : decodedMessages) {
+            LetsPlayProtocol::encodeInto(encoded, decoded);
+            checksum += encoded.size();
+        }
+    }
+    const auto encodeTime = clock::now() - start;
+
+    const auto perMessage = [&](const std::chrono::nanoseconds &time) {
+        return time.count() / static_cast<double>(messages.size() * std::max<std::uint64_t>(options.iterations, 1));
+    };
+
+    std::cout << "Capture:     " << options.capturePath << '\n'
+              << "Messages:    " << messages.size() << " (" << invalid << " invalid) x " << options.iterations << '\n'
+              << "decode:      " << perMessage(referenceTime) << "ns/message (istringstream, before)\n"
+              << "decode:      " << perMessage(vectorTime) << "ns/message (vector<string>)\n"
+              << "decode:      " << perMessage(viewTime) << "ns/message (string_view)\n"
+              << "encode:      " << perMessage(encodeTime) << "ns/message (into a reused buffer)\n"
+              << "Checksum:    " << checksum << '\n';
+
+    if (mismatches) {
+        std::cerr << mismatches << " message(s) decoded differently" << '\n';
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,295 @@
+#include "RomCache.h"
+
+#include <algorithm>
+#include <cctype>
+#include <fstream>
+#include <set>
+#include <sstream>
+
+#include "ZipArchive.h"
+#include "md5.h"
+
+namespace {
+    /**
+     * Files that list the other files of a multi-file rom, preferred over those files when picking what to load
+     */
+    const std::vector<std::string> descriptorExtensions{".m3u", ".cue", ".gdi", ".ccd", ".toc"};
+}
+
+RomImage::RomImage(const boost::filesystem::path &path, bool copyOnWrite)
+        : m_file{path.string().c_str(), boost::interprocess::read_only},
+          m_region{m_file, copyOnWrite ? boost::interprocess::copy_on_write : boost::interprocess::read_only} {}
+
+void *RomImage::data() const {
+    return m_region.get_address();
+}
+
+size_t RomImage::size() const {
+    return m_region.get_size();
+}
+
+ExtractedRom::ExtractedRom(boost::filesystem::path path, boost::filesystem::path entryDirectory)
+        : m_path{std::move(path)}, m_entryDirectory{std::move(entryDirectory)} {}
+
+const boost::filesystem::path &ExtractedRom::path() const {
+    return m_path;
+}
+
+const boost::filesystem::path &ExtractedRom::entryDirectory() const {
+    return m_entryDirectory;
+}
+
+bool RomCache::GetKey(const boost::filesystem::path &path, boost::filesystem::path &canonical, Key &key) {
+    boost::system::error_code err;
+    canonical = boost::filesystem::canonical(path, err);
+    if (err)
+        return false;
+
+    const auto size = boost::filesystem::file_size(canonical, err);
+    if (err)
+        return false;
+
+    const auto mtime = boost::filesystem::last_write_time(canonical, err);
+    if (err)
+        return false;
+
+    key = Key{canonical.string(), size, mtime};
+    return true;
+}
+
+std::shared_ptr<RomImage> RomCache::Open(const boost::filesystem::path &path, bool copyOnWrite) {
+    boost::filesystem::path canonical;
+    Key key;
+    if (!GetKey(path, canonical, key) || std::get<1>(key) == 0) // Empty files can't be mapped
+        return nullptr;
+
+    try {
+        // Private mappings can't be shared
+        if (copyOnWrite)
+            return std::make_shared<RomImage>(canonical, true);
+
+        std::unique_lock<std::mutex> lk(m_mutex);
+        if (auto rom = m_roms[key].lock())
+            return rom;
+
+        // Drop entries for roms nobody is using anymore
+        for (auto it = m_roms.begin(); it != m_roms.end();) {
+            if (it->second.expired())
+                it = m_roms.erase(it);
+            else
+                ++it;
+        }
+
+        auto rom = std::make_shared<RomImage>(canonical, false);
+        m_roms[key] = rom;
+        return rom;
+    } catch (const boost::interprocess::interprocess_exception &) {
+        return nullptr;
+    }
+}
+
+std::shared_ptr<ExtractedRom> RomCache::Extract(const boost::filesystem::path &archive,
+                                                const boost::filesystem::path &cacheDirectory, std::uintmax_t maxBytes,
+                                                const std::string &validExtensions, std::string &error) {
+    namespace fs = boost::filesystem;
+
+    fs::path canonical;
+    Key key;
+    if (!GetKey(archive, canonical, key)) {
+        error = "Couldn't open " + archive.string();
+        return nullptr;
+    }
+
+    std::string hash;
+    {
+        std::unique_lock<std::mutex> lk(m_mutex);
+        auto search = m_archiveHashes.find(key);
+        if (search != m_archiveHashes.end())
+            hash = search->second;
+    }
+
+    if (hash.empty()) {
+        std::ifstream in(canonical.string(), std::ios::binary);
+        if (!in) {
+            error = "Couldn't open " + archive.string();
+            return nullptr;
+        }
+
+        MD5 md5;
+        std::vector<char> buffer(1 << 20);
+        while (in.read(buffer.data(), buffer.size()) || in.gcount() > 0)
+            md5.update(buffer.data(), static_cast<MD5::size_type>(in.gcount()));
+        hash = md5.finalize().hexdigest();
+
+        std::unique_lock<std::mutex> lk(m_mutex);
+        m_archiveHashes[key] = hash;
+    }
+
+    ZipArchive zip;
+    if (!zip.Open(archive)) {
+        error = archive.string() + " isn't a zip file that can be read";
+        return nullptr;
+    }
+
+    std::vector<std::string> extensions;
+    {
+        std::string lowered = validExtensions;
+        std::transform(lowered.begin(), lowered.end(), lowered.begin(), ::tolower);
+
+        std::istringstream ss(lowered);
+        std::string extension;
+        while (std::getline(ss, extension, '|'))
+            if (!extension.empty())
+                extensions.push_back('.' + extension);
+    }
+
+    // Every file is extracted, since multi-file sets (cue+bin, gdi+tracks, m3u+discs) are loaded through a
+    // descriptor that names the others. Names stay relative to the cache entry, and ones that could escape it
+    // are refused.
+    std::vector<std::pair<const ZipEntry *, fs::path>> files;
+    for (const auto &entry : zip.entries()) {
+        if (entry.name.empty() || entry.name.back() == '/')
+            continue;
+
+        const fs::path relative(entry.name);
+        bool safe = !relative.has_root_path();
+        for (const auto &part : relative)
+            safe = safe && part != ".." && part != "." && !part.empty();
+
+        if (!safe) {
+            error = "Bad file name in archive: " + entry.name;
+            return nullptr;
+        }
+
+        files.emplace_back(&entry, relative);
+    }
+
+    if (files.empty()) {
+        error = archive.string() + " is empty";
+        return nullptr;
+    }
+
+    // The file given to the core: a descriptor the core accepts, otherwise the largest file it accepts, otherwise
+    // the largest file
+    const auto rank = [&](const std::pair<const ZipEntry *, fs::path> &file) {
+        auto extension = file.second.extension().string();
+        std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+
+        if (std::find(extensions.begin(), extensions.end(), extension) == extensions.end())
+            return 0;
+
+        return std::find(descriptorExtensions.begin(), descriptorExtensions.end(), extension) !=
+               descriptorExtensions.end() ? 2 : 1;
+    };
+
+    const auto rom = std::max_element(files.begin(), files.end(), [&](const std::pair<const ZipEntry *, fs::path> &a,
+                                                                       const std::pair<const ZipEntry *, fs::path> &b) {
+        const auto rankA = rank(a), rankB = rank(b);
+        return rankA < rankB || (rankA == rankB && a.first->size < b.first->size);
+    });
+
+    std::unique_lock<std::mutex> lk(m_extractMutex);
+
+    const auto entryDirectory = cacheDirectory / hash;
+    const auto romPath = entryDirectory / rom->second;
+
+    boost::system::error_code err;
+    const bool cached = std::all_of(files.begin(), files.end(), [&](const std::pair<const ZipEntry *, fs::path> &file) {
+        const auto path = entryDirectory / file.second;
+        return fs::is_regular_file(path, err) && fs::file_size(path, err) == file.first->size && !err;
+    });
+
+    if (cached) {
+        fs::last_write_time(entryDirectory, std::time(nullptr), err);
+    } else {
+        // Extract next to the cache entry and move it into place, so that a crash partway through can't leave a
+        // truncated rom that looks cached
+        const auto tempDirectory = cacheDirectory / (hash + ".tmp");
+        fs::remove_all(tempDirectory, err);
+        fs::create_directories(tempDirectory, err);
+        if (err) {
+            error = "Couldn't create " + tempDirectory.string() + ": " + err.message();
+            return nullptr;
+        }
+
+        for (const auto &file : files) {
+            const auto destination = tempDirectory / file.second;
+            fs::create_directories(destination.parent_path(), err);
+
+            if (err || !zip.Extract(*file.first, destination)) {
+                fs::remove_all(tempDirectory, err);
+                error = "Couldn't extract " + file.first->name + " from " + archive.string() +
+                        " (corrupt or unsupported)";
+                return nullptr;
+            }
+        }
+
+        fs::remove_all(entryDirectory, err);
+        fs::rename(tempDirectory, entryDirectory, err);
+        if (err) {
+            error = "Couldn't move extracted rom into " + entryDirectory.string() + ": " + err.message();
+            fs::remove_all(tempDirectory, err);
+            return nullptr;
+        }
+    }
+
+    auto extracted = std::make_shared<ExtractedRom>(romPath, entryDirectory);
+    m_extracted.push_back(extracted);
+
+    Evict(cacheDirectory, maxBytes);
+    return extracted;
+}
+
+void RomCache::Evict(const boost::filesystem::path &cacheDirectory, std::uintmax_t maxBytes) {
+    namespace fs = boost::filesystem;
+
+    // Cores that load roms by path can open the files again at any time (CD cores stream tracks), so entries in use
+    // are never deleted
+    std::set<fs::path> inUse;
+    for (auto it = m_extracted.begin(); it != m_extracted.end();) {
+        if (auto extracted = it->lock()) {
+            inUse.insert(extracted->entryDirectory());
+            ++it;
+        } else {
+            it = m_extracted.erase(it);
+        }
+    }
+
+    struct CacheEntry {
+        fs::path path;
+        std::time_t lastUsed;
+        std::uintmax_t size;
+    };
+
+    boost::system::error_code err;
+    std::vector<CacheEntry> cached;
+    std::uintmax_t total{0};
+
+    for (const auto &dir : fs::directory_iterator(cacheDirectory, err)) {
+        if (!fs::is_directory(dir.path(), err) || dir.path().extension() == ".tmp")
+            continue;
+
+        CacheEntry entry{dir.path(), fs::last_write_time(dir.path(), err), 0};
+        for (const auto &file : fs::directory_iterator(dir.path(), err))
+            if (fs::is_regular_file(file.path(), err))
+                entry.size += fs::file_size(file.path(), err);
+
+        total += entry.size;
+        cached.push_back(entry);
+    }
+
+    std::sort(cached.begin(), cached.end(),
+              [](const CacheEntry &a, const CacheEntry &b) { return a.lastUsed < b.lastUsed; });
+
+    for (const auto &entry : cached) {
+        if (total <= maxBytes)
+            break;
+
+        if (inUse.count(entry.path))
+            continue;
+
+        fs::remove_all(entry.path, err);
+        if (!err)
+            total -= entry.size;
+    }
+}
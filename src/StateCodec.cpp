@@ -0,0 +1,235 @@
+#include "StateCodec.h"
+
+#include <cstring>
+#include <fstream>
+
+namespace {
+    /**
+     * Runs shorter than this are cheaper to store as part of a literal
+     */
+    constexpr size_t minRun{4};
+
+    std::uint32_t fnv1a(const std::uint8_t *data, size_t size) {
+        std::uint32_t hash{2166136261u};
+        for (size_t i = 0; i < size; ++i) {
+            hash ^= data[i];
+            hash *= 16777619u;
+        }
+        return hash;
+    }
+
+    void putVarint(std::vector<std::uint8_t> &out, std::uint64_t value) {
+        do {
+            std::uint8_t byte = value & 0x7F;
+            value >>= 7;
+            if (value)
+                byte |= 0x80;
+            out.push_back(byte);
+        } while (value);
+    }
+
+    bool getVarint(const std::uint8_t *&data, const std::uint8_t *end, std::uint64_t &value) {
+        value = 0;
+        for (unsigned shift = 0; shift < 64; shift += 7) {
+            if (data == end)
+                return false;
+
+            const auto byte = *data++;
+            value |= static_cast<std::uint64_t>(byte & 0x7F) << shift;
+            if (!(byte & 0x80))
+                return true;
+        }
+        return false;
+    }
+
+    void putHeader(std::vector<std::uint8_t> &out, kStateKind kind, const std::uint8_t *state, size_t size) {
+        out.assign({'L', 'P', 'S', 'T', StateCodec::version, static_cast<std::uint8_t>(kind), 0, 0});
+
+        for (unsigned i = 0; i < 8; ++i)
+            out.push_back(static_cast<std::uint8_t>(static_cast<std::uint64_t>(size) >> (i * 8)));
+
+        const auto hash = fnv1a(state, size);
+        for (unsigned i = 0; i < 4; ++i)
+            out.push_back(static_cast<std::uint8_t>(hash >> (i * 8)));
+    }
+
+    /**
+     * Run length encodes size bytes given by byteAt(i)
+     */
+    template<typename ByteAt>
+    void compress(size_t size, ByteAt byteAt, std::vector<std::uint8_t> &out) {
+        size_t literalStart{0}, i{0};
+
+        const auto flushLiteral = [&](size_t end) {
+            if (end == literalStart)
+                return;
+
+            putVarint(out, static_cast<std::uint64_t>(end - literalStart) << 1);
+            for (size_t j = literalStart; j < end; ++j)
+                out.push_back(byteAt(j));
+        };
+
+        while (i < size) {
+            const auto value = byteAt(i);
+            size_t runEnd = i + 1;
+            while (runEnd < size && byteAt(runEnd) == value)
+                ++runEnd;
+
+            if (runEnd - i >= minRun) {
+                flushLiteral(i);
+                putVarint(out, (static_cast<std::uint64_t>(runEnd - i) << 1) | 1);
+                out.push_back(value);
+                literalStart = runEnd;
+            }
+
+            i = runEnd;
+        }
+
+        flushLiteral(size);
+    }
+}
+
+constexpr std::uint8_t StateCodec::version;
+constexpr size_t StateCodec::headerSize;
+constexpr std::uint64_t StateCodec::maxStateSize;
+
+void StateCodec::EncodeKeyframe(const std::uint8_t *state, size_t size, std::vector<std::uint8_t> &out) {
+    putHeader(out, kStateKind::Keyframe, state, size);
+    compress(size, [state](size_t i) { return state[i]; }, out);
+}
+
+void StateCodec::EncodeDelta(const std::uint8_t *state, const std::uint8_t *base, size_t size, size_t baseSize,
+                             std::vector<std::uint8_t> &out) {
+    if (size != baseSize) {
+        EncodeKeyframe(state, size, out);
+        return;
+    }
+
+    putHeader(out, kStateKind::Delta, state, size);
+    compress(size, [state, base](size_t i) { return static_cast<std::uint8_t>(state[i] ^ base[i]); }, out);
+}
+
+kStateKind StateCodec::Kind(const std::uint8_t *data, size_t size) {
+    if (size < headerSize || std::memcmp(data, "LPST", 4) != 0)
+        return kStateKind::Raw;
+
+    return static_cast<kStateKind>(data[5]);
+}
+
+bool StateCodec::Decode(const std::uint8_t *data, size_t size, const std::vector<std::uint8_t> *base,
+                        std::vector<std::uint8_t> &out) {
+    const auto kind = Kind(data, size);
+
+    if (kind == kStateKind::Raw) {
+        out.assign(data, data + size);
+        return true;
+    }
+
+    if (data[4] != version || (kind != kStateKind::Keyframe && kind != kStateKind::Delta))
+        return false;
+
+    std::uint64_t rawSize{0};
+    for (unsigned i = 0; i < 8; ++i)
+        rawSize |= static_cast<std::uint64_t>(data[8 + i]) << (i * 8);
+
+    std::uint32_t hash{0};
+    for (unsigned i = 0; i < 4; ++i)
+        hash |= static_cast<std::uint32_t>(data[16 + i]) << (i * 8);
+
+    if (rawSize > maxStateSize || rawSize > out.max_size())
+        return false;
+
+    if (kind == kStateKind::Delta && (!base || base->size() != rawSize))
+        return false;
+
+    // The size comes from the file, so check that the tokens add up to it before allocating that much
+    {
+        const std::uint8_t *in = data + headerSize, *end = data + size;
+        std::uint64_t total{0};
+        while (in != end) {
+            std::uint64_t token;
+            if (!getVarint(in, end, token))
+                return false;
+
+            const std::uint64_t length = token >> 1, payload = (token & 1) ? 1 : length;
+            if (length > rawSize - total || payload > static_cast<std::uint64_t>(end - in))
+                return false;
+
+            in += payload;
+            total += length;
+        }
+
+        if (total != rawSize)
+            return false;
+    }
+
+    out.resize(rawSize);
+
+    const std::uint8_t *in = data + headerSize, *end = data + size;
+    size_t position{0};
+    while (in != end) {
+        std::uint64_t token;
+        if (!getVarint(in, end, token))
+            return false;
+
+        const std::uint64_t length = token >> 1;
+        if (length > rawSize - position)
+            return false;
+
+        if (token & 1) {
+            if (in == end)
+                return false;
+            std::memset(out.data() + position, *in++, length);
+        } else {
+            if (length > static_cast<std::uint64_t>(end - in))
+                return false;
+            std::memcpy(out.data() + position, in, length);
+            in += length;
+        }
+
+        position += length;
+    }
+
+    if (position != rawSize)
+        return false;
+
+    if (kind == kStateKind::Delta) {
+        for (size_t i = 0; i < rawSize; ++i)
+            out[i] ^= (*base)[i];
+    }
+
+    return fnv1a(out.data(), out.size()) == hash;
+}
+
+bool StateCodec::ReadFile(const boost::filesystem::path &path, std::vector<std::uint8_t> &out) {
+    std::ifstream fi(path.string(), std::ios::binary | std::ios::ate);
+    if (!fi)
+        return false;
+
+    out.resize(static_cast<size_t>(fi.tellg()));
+    fi.seekg(0);
+    fi.read(reinterpret_cast<char *>(out.data()), out.size());
+
+    return static_cast<bool>(fi);
+}
+
+bool StateCodec::WriteFile(const boost::filesystem::path &path, const std::vector<std::uint8_t> &data) {
+    auto tempPath = path;
+    tempPath += ".tmp";
+
+    {
+        std::ofstream fo(tempPath.string(), std::ios::binary | std::ios::trunc);
+        fo.write(reinterpret_cast<const char *>(data.data()), data.size());
+        fo.close();
+
+        if (!fo) {
+            boost::system::error_code err;
+            boost::filesystem::remove(tempPath, err);
+            return false;
+        }
+    }
+
+    boost::system::error_code err;
+    boost::filesystem::rename(tempPath, path, err);
+    return !err;
+}
@@ -0,0 +1,188 @@
+#include "ZipArchive.h"
+
+#include <algorithm>
+#include <fstream>
+
+namespace {
+    constexpr std::uint32_t localHeaderSignature{0x04034b50};
+    constexpr std::uint32_t centralHeaderSignature{0x02014b50};
+    constexpr std::uint32_t endSignature{0x06054b50};
+    constexpr std::uint32_t zip64EndSignature{0x06064b50};
+    constexpr std::uint32_t zip64LocatorSignature{0x07064b50};
+
+    constexpr size_t endSize{22};
+    constexpr size_t zip64LocatorSize{20};
+    constexpr size_t centralHeaderSize{46};
+    constexpr size_t localHeaderSize{30};
+
+    std::uint64_t readLE(const std::uint8_t *data, unsigned bytes) {
+        std::uint64_t value{0};
+        for (unsigned i = 0; i < bytes; ++i)
+            value |= static_cast<std::uint64_t>(data[i]) << (i * 8);
+        return value;
+    }
+
+    bool readAt(std::ifstream &file, std::uint64_t offset, std::vector<std::uint8_t> &out, size_t size) {
+        out.resize(size);
+        file.clear();
+        file.seekg(static_cast<std::streamoff>(offset));
+        file.read(reinterpret_cast<char *>(out.data()), size);
+        return static_cast<size_t>(file.gcount()) == size;
+    }
+}
+
+bool ZipArchive::Open(const boost::filesystem::path &path) {
+    m_path = path;
+    m_entries.clear();
+
+    std::ifstream file(path.string(), std::ios::binary);
+    if (!file)
+        return false;
+
+    boost::system::error_code err;
+    const auto fileSize = boost::filesystem::file_size(path, err);
+    if (err || fileSize < endSize)
+        return false;
+
+    // The end record is at the end, followed by a comment of up to 64 KiB
+    const auto tailSize = static_cast<size_t>(std::min<std::uint64_t>(fileSize, endSize + 0xFFFF + zip64LocatorSize));
+    std::vector<std::uint8_t> tail;
+    if (!readAt(file, fileSize - tailSize, tail, tailSize))
+        return false;
+
+    size_t end = tailSize - endSize + 1;
+    do {
+        --end;
+        if (readLE(tail.data() + end, 4) == endSignature)
+            break;
+    } while (end > 0);
+
+    if (readLE(tail.data() + end, 4) != endSignature)
+        return false;
+
+    std::uint64_t entryCount = readLE(tail.data() + end + 10, 2);
+    std::uint64_t directorySize = readLE(tail.data() + end + 12, 4);
+    std::uint64_t directoryOffset = readLE(tail.data() + end + 16, 4);
+
+    // Values that don't fit are in the zip64 end record
+    if (entryCount == 0xFFFF || directorySize == 0xFFFFFFFF || directoryOffset == 0xFFFFFFFF) {
+        if (end < zip64LocatorSize ||
+            readLE(tail.data() + end - zip64LocatorSize, 4) != zip64LocatorSignature)
+            return false;
+
+        std::vector<std::uint8_t> zip64End;
+        const auto zip64EndOffset = readLE(tail.data() + end - zip64LocatorSize + 8, 8);
+        if (!readAt(file, zip64EndOffset, zip64End, 56) || readLE(zip64End.data(), 4) != zip64EndSignature)
+            return false;
+
+        entryCount = readLE(zip64End.data() + 32, 8);
+        directorySize = readLE(zip64End.data() + 40, 8);
+        directoryOffset = readLE(zip64End.data() + 48, 8);
+    }
+
+    if (directoryOffset + directorySize > fileSize)
+        return false;
+
+    std::vector<std::uint8_t> directory;
+    if (!readAt(file, directoryOffset, directory, static_cast<size_t>(directorySize)))
+        return false;
+
+    size_t position{0};
+    for (std::uint64_t i = 0; i < entryCount; ++i) {
+        if (position + centralHeaderSize > directory.size())
+            return false;
+
+        const auto *header = directory.data() + position;
+        if (readLE(header, 4) != centralHeaderSignature)
+            return false;
+
+        ZipEntry entry;
+        entry.flags = static_cast<std::uint16_t>(readLE(header + 8, 2));
+        entry.method = static_cast<std::uint16_t>(readLE(header + 10, 2));
+        entry.crc = static_cast<std::uint32_t>(readLE(header + 16, 4));
+        entry.compressedSize = readLE(header + 20, 4);
+        entry.size = readLE(header + 24, 4);
+        entry.localHeaderOffset = readLE(header + 42, 4);
+
+        const auto nameLength = readLE(header + 28, 2), extraLength = readLE(header + 30, 2),
+                commentLength = readLE(header + 32, 2);
+
+        if (position + centralHeaderSize + nameLength + extraLength + commentLength > directory.size())
+            return false;
+
+        entry.name.assign(reinterpret_cast<const char *>(header + centralHeaderSize), nameLength);
+
+        // Zip64 extra field has the 64 bit versions of whichever values were saturated, in this order
+        const auto *extra = header + centralHeaderSize + nameLength;
+        for (size_t e = 0; e + 4 <= extraLength;) {
+            const auto id = readLE(extra + e, 2), length = readLE(extra + e + 2, 2);
+            if (e + 4 + length > extraLength)
+                break;
+
+            if (id == 0x0001) {
+                size_t field = e + 4;
+                for (auto *value : {&entry.size, &entry.compressedSize, &entry.localHeaderOffset}) {
+                    if (*value != 0xFFFFFFFF)
+                        continue;
+                    if (field + 8 > e + 4 + length)
+                        return false;
+                    *value = readLE(extra + field, 8);
+                    field += 8;
+                }
+            }
+
+            e += 4 + length;
+        }
+
+        m_entries.push_back(entry);
+        position += centralHeaderSize + nameLength + extraLength + commentLength;
+    }
+
+    return true;
+}
+
+const std::vector<ZipEntry> &ZipArchive::entries() const {
+    return m_entries;
+}
+
+bool ZipArchive::Extract(const ZipEntry &entry, const boost::filesystem::path &destination) const {
+    if ((entry.flags & 1) || (entry.method != 0 && entry.method != 8)) // Encrypted or an unsupported method
+        return false;
+
+    std::ifstream file(m_path.string(), std::ios::binary);
+    std::vector<std::uint8_t> header;
+    if (!readAt(file, entry.localHeaderOffset, header, localHeaderSize) ||
+        readLE(header.data(), 4) != localHeaderSignature)
+        return false;
+
+    const auto dataOffset = entry.localHeaderOffset + localHeaderSize + readLE(header.data() + 26, 2) +
+                            readLE(header.data() + 28, 2);
+    file.seekg(static_cast<std::streamoff>(dataOffset));
+
+    std::ofstream out(destination.string(), std::ios::binary | std::ios::trunc);
+    if (!out)
+        return false;
+
+    std::uint32_t crc{0};
+    std::uint64_t size{0};
+
+    if (entry.method == 8) {
+        if (!Inflater::Inflate(file, out, entry.size, crc, size))
+            return false;
+    } else {
+        std::vector<std::uint8_t> buffer(1 << 20);
+        while (size < entry.compressedSize) {
+            const auto chunk = static_cast<size_t>(std::min<std::uint64_t>(buffer.size(), entry.compressedSize - size));
+            file.read(reinterpret_cast<char *>(buffer.data()), chunk);
+            if (static_cast<size_t>(file.gcount()) != chunk)
+                return false;
+
+            crc = Inflater::Crc32(crc, buffer.data(), chunk);
+            out.write(reinterpret_cast<const char *>(buffer.data()), chunk);
+            size += chunk;
+        }
+    }
+
+    out.close();
+    return out && size == entry.size && crc == entry.crc;
+}